@@ -0,0 +1,94 @@
+#pragma once
+
+#if defined(EBUS_INTERNAL)
+#include <Arduino.h>
+
+#include <string>
+
+// The TCP clients and the internal schedule share the bus of the adapter. The
+// arbiter lets one of them at a time start a transaction. A waiting source
+// that has used less than its quota of the bus time goes before one that has
+// used more, then the higher priority class goes first, then the source that
+// has been waiting longer. Nobody waits for a source over its quota if the bus
+// is free otherwise, so neither source can starve the other.
+enum class BusSource { client, schedule };
+constexpr int BUS_SOURCES = 2;
+
+// Priority class and percentage of the bus time of each source
+#ifndef ARBITER_PRIORITY_CLIENT
+#define ARBITER_PRIORITY_CLIENT 0
+#endif
+#ifndef ARBITER_PRIORITY_SCHEDULE
+#define ARBITER_PRIORITY_SCHEDULE 1
+#endif
+#ifndef ARBITER_QUOTA_CLIENT
+#define ARBITER_QUOTA_CLIENT 50
+#endif
+#ifndef ARBITER_QUOTA_SCHEDULE
+#define ARBITER_QUOTA_SCHEDULE 25
+#endif
+
+// The bus time is counted over two windows of this length
+#define ARBITER_WINDOW_MICROS 5000000
+// A source that did not ask again for this long is no longer waiting
+#define ARBITER_STALE_MICROS 50000
+// A source holding the bus for this long is assumed to have lost its release
+#define ARBITER_HOLD_MICROS 2000000
+
+class BusArbiter {
+ public:
+  BusArbiter();
+
+  void configure(BusSource source, uint8_t priority, uint8_t quota);
+
+  // Asks for the bus, to be repeated while waiting. Returns true if the
+  // source holds the bus now and may start its transaction.
+  bool acquire(BusSource source);
+  // The transaction of the source is over
+  void release(BusSource source);
+
+  // Called when the bus is released while the source waits for it, so its
+  // task can ask again at once instead of at its next poll. Runs in the task
+  // that releases, must not block.
+  void setWakeup(BusSource source, void (*wakeup)());
+
+  bool holds(BusSource source) const;
+
+  const std::string getArbiterJson();
+
+ private:
+  struct Source {
+    uint8_t priority = 0;
+    uint8_t quota = 100;  // percent of the bus time
+    bool waiting = false;
+    uint32_t since = 0;         // micros() when the source started to wait
+    uint32_t lastAsk = 0;       // micros() of the last acquire
+    uint32_t usedCurrent = 0;   // bus time in the current window
+    uint32_t usedPrevious = 0;  // bus time in the previous window
+    uint32_t requests = 0;      // waits started
+    uint32_t grants = 0;
+    uint64_t waitTotal = 0;  // micros waited for the grants
+    uint32_t waitMax = 0;
+    uint64_t busTotal = 0;  // micros the source held the bus
+    uint32_t timeouts = 0;  // holds ended by ARBITER_HOLD_MICROS
+    void (*wakeup)() = nullptr;
+  };
+
+  SemaphoreHandle_t mutex;
+  Source sources[BUS_SOURCES];
+  int holder = -1;
+  uint32_t holdStart = 0;
+  uint32_t windowStart = 0;
+
+  // Called with the mutex taken
+  void rollWindow(uint32_t now);
+  void releaseLocked(uint32_t now);
+  // The sources waiting for the bus, as a bit mask
+  unsigned waitingLocked() const;
+  void wake(unsigned waiting);
+  bool overQuota(const Source& source) const;
+  bool before(int a, int b) const;
+};
+
+extern BusArbiter arbiter;
+#endif
@@ -1,6 +1,23 @@
 #pragma once
 
+#include <atomic>
+
 #include "busstate.hpp"
+#include "histogram.hpp"
+
+// Time source and one-shot timer used by the arbitration to put the master
+// address on the bus at the right instant. Keeps the timing calculation
+// independent of the hardware, so it can be exercised with a fake clock.
+class ArbitrationClock {
+ public:
+  virtual ~ArbitrationClock() {}
+  virtual uint32_t now() = 0;
+  // Call "fn(arg)" once, "delay" micros from now. A delay of 0 calls it
+  // immediately from the calling task.
+  virtual void once(uint32_t delay, void (*fn)(void*), void* arg) = 0;
+  // Stop a pending "once" call, if any. Nothing happens if it already ran.
+  virtual void cancel() = 0;
+};
 
 // Implements the arbitration algorithm. Uses the state of the bus to decide
 // what to do. Typical usage:
@@ -21,11 +38,18 @@ class Arbitration {
     restart2,     // restart the arbitration
   };
 
-  Arbitration()
-      : _arbitrating(false),
-        _participateSecond(false),
-        _arbitrationAddress(0),
-        _restartCount(0) {}
+  // Window in which the master address needs to be on the bus, measured from
+  // the start bit of the SYN symbol
+  static constexpr int32_t WINDOW_BEGIN = 4300;
+  static constexpr int32_t WINDOW_END = 4456;
+  // Initial estimate of the time the uart needs to put a written symbol on
+  // the bus. Testing has shown this is about 700 micros on the esp32-c3. The
+  // estimate is refined with the echo of each master address we send.
+  static constexpr int32_t UART_LATENCY = 700;
+
+  // Uses the esp_timer based clock when no clock is specified
+  explicit Arbitration(ArbitrationClock* clock = nullptr);
+
   // Try to start arbitration for the specified master.
   // Return values:
   // - started     : arbitration started. Make sure to pass all bus data to this
@@ -39,14 +63,137 @@ class Arbitration {
   enum result { started, not_started, late };
   result start(const BusState& busstate, uint8_t master, uint32_t startBitTime);
 
+  // Schedule the master address on the start bit of the symbol that follows
+  // a complete telegram, which should be the SYN that frees the bus. This is
+  // well ahead of "start", which can only be called once the SYN has been
+  // received and is then often too late. The prearmed arbitration has to be
+  // settled with "confirm" when that SYN is received, "start" does nothing
+  // until then. Returns true if the address was scheduled.
+  //
+  // The address is handed to the uart about WINDOW_BEGIN - latency() after
+  // the start bit, while the last bits of the SYN are still on the bus. So it
+  // can only be withdrawn until then and "confirm" usually finds it sent.
+  bool prearm(const BusState& busstate, uint8_t master, uint32_t startBitTime);
+  bool prearmed() const { return _prearmed; }
+
+  // Settle the prearmed arbitration with the symbol received after it. owner
+  // tells if the client that requested the prearm still waits for master.
+  // Return values:
+  // - confirmed : the symbol is the expected SYN and the arbitration for
+  //               master runs, pass all bus data to the "data" method as after
+  //               "start"
+  // - withdrawn : nothing was sent, "start" can be called as usual
+  // - orphaned  : the address was sent but nobody waits for it anymore,
+  //               because the client went away or asks for another address,
+  //               or the symbol was not the expected SYN. This is the normal
+  //               outcome of such a change once the timer has fired. The
+  //               arbitration runs and has to be followed with "data" like any
+  //               other, if it is won the bus has to be freed with a SYN.
+  enum prearmResult { confirmed, withdrawn, orphaned };
+  prearmResult confirm(const BusState& busstate, bool owner, uint8_t master,
+                       uint32_t startBitTime);
+
+  // The client of the prearmed arbitration went away. Can be called from any
+  // task, the address is not sent anymore unless the timer already handed it
+  // to the uart. Returns true if it was withdrawn.
+  bool withdraw();
+
   // A symbol was received on the bus, what does this do to the arbitration
   // state? Return values: see description of state enum value
   Arbitration::state data(BusState& busstate, uint8_t symbol,
                           uint32_t startBitTime);
 
+  // Delay in micros from "now" until the master address has to be handed to
+  // the uart, so it is on the bus at the begin of the arbitration window.
+  // Negative if that instant has already passed.
+  static int32_t sendDelay(uint32_t startBitTime, uint32_t now,
+                           int32_t latency) {
+    return WINDOW_BEGIN - static_cast<int32_t>(now - startBitTime) - latency;
+  }
+
+  // Learned uart latency in micros and its variance in micros^2
+  int32_t latency() const { return _latencyMean >> LATENCY_SHIFT; }
+  int32_t latencyVariance() const { return _latencyVariance; }
+  uint32_t latencySamples() const { return _latencySamples; }
+
+  // Echoes of our master address, also of those that lost, and how many of
+  // them started in the arbitration window
+  uint32_t echoes() const { return _echoes; }
+  uint32_t windowHits() const { return _windowHits; }
+
+  // Prearmed arbitrations, those that were not followed by the expected SYN
+  // and those whose address was on the bus without a client waiting for it
+  uint32_t prearms() const { return _prearms; }
+  uint32_t prearmMisses() const { return _prearmMisses; }
+  uint32_t prearmOrphans() const { return _prearmOrphans; }
+
+  // Timing of the arbitration attempts, by their outcome. All in micros:
+  // - send  : from the start bit of the SYN until the master address was
+  //           handed to the uart; for late attempts until giving up
+  // - delay : computed wait before handing the master address to the uart
+  // - gap   : from the start bit of the SYN to the start bit of the address
+  //           received on the bus
+  typedef Histogram<3072, 128> SynHistogram;
+  typedef Histogram<-1024, 320> DelayHistogram;
+  struct Timing {
+    SynHistogram send;
+    DelayHistogram delay;
+    SynHistogram gap;
+  };
+  enum outcome { outcomeWon, outcomeLost, outcomeLate };
+  const Timing& timing(outcome o) const { return _timing[o]; }
+
  private:
+  ArbitrationClock* _clock;
   bool _arbitrating;
   bool _participateSecond;
   uint8_t _arbitrationAddress;
   int _restartCount;
+
+  // Start bits of the prearm and of the SYN measured by different interrupts
+  // may differ slightly
+  static constexpr int32_t PREARM_TOLERANCE = 208;
+  bool _prearmed;
+  uint32_t _prearms;
+  uint32_t _prearmMisses;
+  uint32_t _prearmOrphans;
+
+  // Progress of the address handed to the clock, shared with the clock's task
+  // and with "withdraw". Only an armed prearm can be withdrawn, so only until
+  // the timer fires.
+  enum sendState : uint8_t {
+    sendIdle,       // nothing to send
+    sendArmed,      // prearmed, not yet confirmed
+    sendScheduled,  // will be sent
+    sendDone,       // handed to the uart
+    sendWithdrawn,  // will not be sent
+  };
+  std::atomic<uint8_t> _send;
+
+  // Calibration of the uart latency. The mean is kept with LATENCY_SHIFT
+  // fractional bits and both mean and variance are exponentially weighted
+  // with a factor of 1/2^LATENCY_SHIFT, using integer math only.
+  static constexpr int LATENCY_SHIFT = 4;
+  std::atomic<uint32_t> _writeTime;  // when the address was handed to the uart
+  uint32_t _synStartBit;             // start bit of the SYN we arbitrate on
+  int32_t _latencyMean;
+  int32_t _latencyVariance;
+  uint32_t _latencySamples;
+  uint32_t _echoes;
+  uint32_t _windowHits;
+
+  // Delay and address gap of the running attempt, recorded with its outcome
+  int32_t _delay;
+  uint32_t _gap;
+  Timing _timing[outcomeLate + 1];
+  void record(outcome o);
+
+  // Update the latency estimate with the start bit of the address received
+  // after ours was written, won or lost
+  void calibrate(uint32_t echoStartBitTime);
+
+  // Hand the master address to the uart at the right instant after the start
+  // bit of the SYN, without blocking the calling task
+  int32_t schedule(uint32_t startBitTime);
+  static void transmit(void* arg);
 };
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes handed to the socket of one reader in one go
+#define BROADCAST_CHUNK 64
+
+// Most bytes a single record or the overflow marker is encoded to
+#define BROADCAST_RECORD_MAX 2
+
+// Ring of timestamped records written by one producer and read by any number
+// of readers, each with its own cursor. Readers never hold up the producer:
+// a reader that falls more than N records behind loses the oldest ones, is
+// told so by an overflow marker and has them added to its drop counter. The
+// ring has no locking, producer and readers have to run in the same task.
+template <typename T, size_t N>
+class BroadcastRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  struct Record {
+    uint32_t time;  // micros() when the record was pushed
+    T value;
+  };
+
+  // State of one reader
+  struct Cursor {
+    size_t next = 0;       // next record to be read
+    uint32_t dropped = 0;  // records lost because the reader fell behind
+    bool overrun = false;  // overflow marker still to be written
+    bool urgent = false;   // drain at the next opportunity
+    // Bytes of an item that was taken only in part. They are written before
+    // anything else, so the reader gets whole items even if the record
+    // itself is overwritten in the meantime.
+    uint8_t rest[BROADCAST_RECORD_MAX];
+    uint8_t restLen = 0;
+  };
+
+  void push(const T& value, uint32_t time) {
+    _buffer[_head & (N - 1)] = {time, value};
+    _head++;
+  }
+
+  // Makes the cursor skip everything pushed so far, e.g. for a new reader.
+  void reset(Cursor& cursor) const {
+    cursor = Cursor();
+    cursor.next = _head;
+  }
+
+  size_t pending(const Cursor& cursor) const { return _head - cursor.next; }
+
+  // True if the reader has records, the overflow marker or the rest of an
+  // item to write
+  bool unread(const Cursor& cursor) const {
+    return pending(cursor) > 0 || cursor.overrun || cursor.restLen > 0;
+  }
+
+  // Time of the oldest record the reader has not read yet.
+  uint32_t oldest(const Cursor& cursor) const {
+    return pending(cursor) > N ? _buffer[_head & (N - 1)].time
+                               : _buffer[cursor.next & (N - 1)].time;
+  }
+
+  // Encodes the unread records with encode(value, out), which returns the
+  // number of bytes written to out (0 to skip the record), and hands them to
+  // write(data, len), which returns the number of bytes taken or -1 on error.
+  // An item taken only in part is continued on the next call, before the
+  // overflow marker. Returns the number of bytes taken or -1 if write failed.
+  template <typename Encode, typename Write>
+  int drain(Cursor& cursor, const uint8_t* marker, size_t markerLen,
+            Encode encode, Write write) const {
+    if (_head - cursor.next > N) {
+      cursor.dropped += _head - N - cursor.next;
+      cursor.next = _head - N;
+      cursor.overrun = true;
+    }
+    cursor.urgent = false;
+
+    uint8_t buffer[BROADCAST_CHUNK];
+    uint8_t ends[BROADCAST_CHUNK];  // end of each item in buffer
+    size_t items = 0;
+    size_t len = 0;
+
+    const bool rest = cursor.restLen > 0;
+    if (rest) {
+      for (size_t i = 0; i < cursor.restLen; i++)
+        buffer[len++] = cursor.rest[i];
+      ends[items++] = len;
+    }
+    if (cursor.overrun) {
+      for (size_t i = 0; i < markerLen; i++) buffer[len++] = marker[i];
+      ends[items++] = len;
+    }
+
+    for (size_t next = cursor.next; next != _head; next++) {
+      if (items == BROADCAST_CHUNK ||
+          len + BROADCAST_RECORD_MAX > BROADCAST_CHUNK)
+        break;
+      len += encode(_buffer[next & (N - 1)].value, buffer + len);
+      ends[items++] = len;
+    }
+
+    int taken = 0;
+    if (len > 0) {
+      taken = write(buffer, len);
+      if (taken < 0) return -1;
+    }
+
+    // skip the items that are complete now, an item taken in part leaves its
+    // rest in the cursor
+    size_t done = taken;
+    size_t item = 0;
+    while (item < items && ends[item] <= done) item++;
+    size_t restLen = 0;
+    if (item < items && done > (item > 0 ? ends[item - 1] : 0)) {
+      restLen = ends[item] - done;
+      for (size_t i = 0; i < restLen; i++) cursor.rest[i] = buffer[done + i];
+      item++;
+    }
+    if (rest && item > 0) {
+      cursor.restLen = 0;
+      item--;
+    }
+    if (cursor.overrun && item > 0) {
+      cursor.overrun = false;
+      item--;
+    }
+    cursor.next += item;
+    if (restLen > 0) cursor.restLen = restLen;
+
+    return taken;
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  Record _buffer[N];
+  size_t _head = 0;
+};
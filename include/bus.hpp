@@ -1,11 +1,11 @@
 #pragma once
 
 #include <WiFiClient.h>
-
-#include <queue>
+#include <esp_timer.h>
 
 #include "arbitration.hpp"
 #include "busstate.hpp"
+#include "ringbuffer.hpp"
 
 enum responses {
   RESETTED = 0x0,
@@ -19,15 +19,51 @@ enum responses {
 
 enum errors { ERR_FRAMING = 0x00, ERR_OVERRUN = 0x01 };
 
+// Pending CMD_START requests of the enhanced clients are served in order on
+// successive SYNs. Every client has at most one request in the queue; a client
+// repeating its request keeps its place, so no client can starve the others.
+#define ARBITRATION_QUEUE_SIZE MAX_WIFI_CLIENTS
+
+// A lost arbitration is retried for the same address on the next SYN up to
+// this many times before FAILED is sent to the client. This saves the client
+// the round trip for a new CMD_START, which often misses the next SYN. Off by
+// default, can be set with a build flag.
+#ifndef ARBITRATION_RETRIES
+#define ARBITRATION_RETRIES 0
+#endif
+
+// Requests of one enhanced client, wait times in micros from CMD_START to the
+// result of the arbitration
+struct ArbitrationWait {
+  uint32_t requests = 0;
+  uint32_t served = 0;
+  uint32_t cancelled = 0;
+  uint64_t totalWait = 0;
+  uint32_t maxWait = 0;
+};
+
 void getArbitrationClient(WiFiClient*& client, uint8_t& address);
-void clearArbitrationClient();
+void clearArbitrationClient(WiFiClient* client);
 bool setArbitrationClient(WiFiClient*& client, uint8_t& address);
+size_t arbitrationQueued();
+void getArbitrationWaits(ArbitrationWait (&waits)[MAX_WIFI_CLIENTS]);
 
-void arbitrationDone();
+bool arbitrationRetry(WiFiClient* client);
+uint8_t arbitrationDone(WiFiClient* client);
 WiFiClient* arbitrationRequested(uint8_t& address);
 
-#include "atomic"
-#define ATOMIC_INT std::atomic<int>
+// The enhanced clients are referred to by their slot in the enhanced clients
+// array. This keeps the records passed from the serial task small.
+#define NO_CLIENT 0xff
+void setEnhancedClients(WiFiClient* clients);
+uint8_t clientSlot(const WiFiClient* client);
+
+// Must be a power of two; 4 bytes per entry
+#define QUEUE_SIZE 512
+
+// Symbols sent for clients whose echo is still to be verified; must be a
+// power of two, 12 bytes per entry
+#define ECHO_QUEUE_SIZE 64
 
 // This object retrieves data from the Serial object and let's
 // it flow through the arbitration process. The "read" method
@@ -38,13 +74,16 @@ class BusType {
  public:
   // "receive" data should go to all clients that are not in arbitration mode
   // "enhanced" data should go only to the arbitrating client
-  // a client is in arbitration mode if _client is not null
+  // a client is in arbitration mode if DATA_SKIP_CLIENT is set
+  enum flags : uint8_t {
+    DATA_ENHANCED = 0x01,     // is this an enhanced command?
+    DATA_SKIP_CLIENT = 0x02,  // do not send to the arbitrating client
+  };
   struct data {
-    bool _enhanced;       // is this an enhanced command?
-    uint8_t _c;           // command byte, only used when in "enhanced" mode
-    uint8_t _d;           // data byte for both regular and enhanced command
-    WiFiClient* _client;  // the client that is being arbitrated
-    WiFiClient* _logtoclient;  // the client that needs to log
+    uint8_t _flags;   // combination of flags
+    uint8_t _c;       // command byte, only used when in "enhanced" mode
+    uint8_t _d;       // data byte for both regular and enhanced command
+    uint8_t _client;  // slot of the arbitrating client, also used for logging
   };
   BusType();
   ~BusType();
@@ -56,6 +95,13 @@ class BusType {
   // Is there a value available that should be send to a client?
   bool read(data& d);
   size_t write(uint8_t symbol);
+  size_t write(const uint8_t* buffer, size_t size);
+
+  // Write symbols of a client and compare them with their echo from the bus.
+  // On a mismatch the enhanced client in slot gets ERROR_EBUS right away.
+  // Only to be called from the task that handles the clients.
+  size_t send(uint8_t symbol, uint8_t slot);
+  size_t send(const uint8_t* buffer, size_t size, uint8_t slot);
   int availableForWrite();
   int available();
 
@@ -66,10 +112,33 @@ class BusType {
   ATOMIC_INT _nbrArbitrations;
   ATOMIC_INT _nbrLost1;
   ATOMIC_INT _nbrLost2;
+  ATOMIC_INT _nbrRetries;     // lost arbitrations retried by the firmware
+  ATOMIC_INT _nbrRetriesWon;  // won after a retry, saving a client round trip
   ATOMIC_INT _nbrWon1;
   ATOMIC_INT _nbrWon2;
   ATOMIC_INT _nbrErrors;
   ATOMIC_INT _nbrLate;
+  ATOMIC_INT _nbrOverflows;
+  ATOMIC_INT _nbrCollisions;     // echo of a sent symbol was different
+  ATOMIC_INT _nbrEchoMissing;    // no echo of a sent symbol in time
+  ATOMIC_INT _nbrEchoUntracked;  // sent while the echo queue was full
+  ATOMIC_INT _maxQueued;
+  ATOMIC_INT _readerCpuTime;  // ms spent in the serial task
+  ATOMIC_INT _readerLoad;     // per mille of the cpu used by the serial task
+  // Least free stack of the serial task so far in bytes, 0 if not running
+  int readerStackFree() const;
+
+  static constexpr size_t queueCapacity() { return QUEUE_SIZE; }
+  size_t queued() const { return _queue.size(); }
+
+  // Called after each record put in the queue, e.g. to wake up the reader
+  void setReadCallback(void (*callback)());
+
+  const Arbitration& arbitration() const { return _arbitration; }
+
+  // The client went away, do not send the address prearmed for it
+  void withdraw(const WiFiClient* client);
+  const TelegramDecoder& telegrams() const { return _busState._telegrams; }
 
  private:
   inline void push(const data& d);
@@ -77,21 +146,50 @@ class BusType {
   BusState _busState;
   Arbitration _arbitration;
   WiFiClient* _client;
+  std::atomic<WiFiClient*> _prearmClient;  // client of the prearmed address
+
+  // queue from Bus to read method
+  RingBuffer<data, QUEUE_SIZE> _queue;
+
+  // symbols sent for clients, from send to receive
+  struct echo {
+    uint32_t _time;      // when the symbol was handed to the uart
+    uint32_t _deadline;  // latest start bit time of the echo
+    uint8_t _symbol;
+    uint8_t _client;  // slot of the sending enhanced client or NO_CLIENT
+  };
+  RingBuffer<echo, ECHO_QUEUE_SIZE> _echoes;
+  void verifyEcho(uint8_t symbol, uint32_t startBitTime);
+  void (*_readCallback)() = nullptr;
 
 #if USE_ASYNCHRONOUS
   // handler to be notified when there is signal change on the serial input
   static void IRAM_ATTR receiveHandler();
 
-  // queue from Bus to read method
-  QueueHandle_t _queue;
+  // start bit of the frame being received and the time after which an edge
+  // belongs to the next frame; written by receiveHandler. The end is reset
+  // to 0 by the frame timer once it has passed, so it is never compared with
+  // a time that is more than a frame away.
+  volatile uint32_t _frameStart = 0;
+  std::atomic<uint32_t> _frameEdgesEnd{0};
+
+  // one shot timer for the expected end of the current frame
+  esp_timer_handle_t _frameTimer = 0;
+  static void frameTimerHandler(void* args);
+  void armFrameTimer(uint32_t delay);
+
+  // pass all complete frames to receive; returns false if there was none
+  bool readFrames();
+
+  // start bit of a new frame; prearm a pending arbitration if the frame should
+  // be the SYN at the end of a telegram
+  void prearm(uint32_t startBitTime);
 
   // task to read bytes form the serial object and process them with receive
   // methods
   TaskHandle_t _serialEventTask;
 
   static void readDataFromSoftwareSerial(void* args);
-#else
-  std::queue<data> _queue;
 #endif
 };
 
@@ -1,8 +1,15 @@
 #pragma once
 
 #include "main.hpp"
+#include "telegram.hpp"
 
-enum symbols { SYN = 0xAA };
+enum symbols {
+  SYN = 0xAA,
+  ESC = 0xA9,  // escape symbol, ESC 0x00 stands for ESC and ESC 0x01 for SYN
+  ACK = 0x00,
+  NACK = 0xFF,
+  BROADCAST = 0xFE  // target address of broadcast telegrams
+};
 
 // Implements the state of the bus. The arbitration process can
 // only start at well defined states of the bus. To asses the
@@ -36,10 +43,16 @@ class BusState {
                             "eBusy"};
     return values[e];
   }
+
+  // Duration of one symbol on the bus: start bit, 8 data bits and stop bit
+  static constexpr uint32_t SYMBOL_MICROS = 4167;
+
   BusState() : _state(eStartup), _previousState(eStartup) {}
   // Evaluate a symbol received on UART and determine what the new state of the
   // bus is
-  inline void data(uint8_t symbol) {
+  inline void data(uint8_t symbol, uint32_t startBitTime) {
+    _symbolTime = startBitTime;
+    _telegrams.data(symbol);
     switch (_state) {
       case eStartup:
         _previousState = _state;
@@ -104,6 +117,34 @@ class BusState {
 
   void reset() { _state = eStartup; }
 
+  // The running telegram is complete, so the next symbol on the bus should be
+  // the SYN that frees it
+  bool telegramComplete() const {
+    return _state == eBusy && _telegrams.done();
+  }
+
+  // Minimum number of symbols until the running telegram is complete, -1 if
+  // no telegram is followed
+  int telegramRemaining() const {
+    return _state == eBusy ? _telegrams.remaining() : -1;
+  }
+
+  // Time at which the bus is expected to be free again, measured in micros()
+  // like the start bit times. Only meaningful if telegramRemaining() >= 0.
+  // Once the telegram is complete, this is the earliest start bit of its SYN.
+  uint32_t expectedFree() const {
+    return _symbolTime + (telegramRemaining() + 1) * SYMBOL_MICROS;
+  }
+
+  // Master addresses have one of 0, 1, 3, 7 or F in both nibbles
+  static bool isMaster(uint8_t address) {
+    auto priority = [](uint8_t nibble) {
+      return nibble == 0x0 || nibble == 0x1 || nibble == 0x3 ||
+             nibble == 0x7 || nibble == 0xF;
+    };
+    return priority(address >> 4) && priority(address & 0x0F);
+  }
+
   const uint32_t microsSinceLastSyn() const { return micros() - _SYNtime; }
 
   const uint32_t microsSincePreviousSyn() const {
@@ -116,4 +157,7 @@ class BusState {
   uint8_t _symbol = 0;
   uint32_t _SYNtime = 0;
   uint32_t _previousSYNtime = 0;
+
+  TelegramDecoder _telegrams;  // the running telegram and the statistics
+  uint32_t _symbolTime = 0;    // start bit of the last symbol
 };
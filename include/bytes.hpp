@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Longest telegram parts: QQ ZZ PB SB NN, 16 data bytes and CRC for the
+// master, NN, 16 data bytes and CRC for the slave
+#define TELEGRAM_MASTER_MAX 22
+#define TELEGRAM_SLAVE_MAX 18
+
+// Non-owning view of bytes, valid as long as their owner. Vectors convert
+// implicitly, so the commands and filters kept as vectors can be compared
+// with telegram parts that never were on the heap.
+class ByteView {
+ public:
+  ByteView() = default;
+  ByteView(const uint8_t* data, size_t size) : ptr(data), len(size) {}
+  ByteView(const std::vector<uint8_t>& vec)
+      : ptr(vec.data()), len(vec.size()) {}
+
+  const uint8_t* data() const { return ptr; }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+
+  const uint8_t* begin() const { return ptr; }
+  const uint8_t* end() const { return ptr + len; }
+
+  uint8_t operator[](size_t i) const { return ptr[i]; }
+
+  // count bytes from pos, cut off at the end like ebus::range
+  ByteView range(size_t pos, size_t count) const {
+    if (pos >= len) return ByteView();
+    return ByteView(ptr + pos, std::min(count, len - pos));
+  }
+
+  // true if search is found at pos, like ebus::contains
+  bool contains(ByteView search, size_t pos = 1) const {
+    if (pos > len || search.len > len - pos) return false;
+    return std::equal(search.begin(), search.end(), ptr + pos);
+  }
+
+  bool operator==(ByteView other) const {
+    return len == other.len && std::equal(begin(), end(), other.begin());
+  }
+
+ private:
+  const uint8_t* ptr = nullptr;
+  size_t len = 0;
+};
+
+// Up to N bytes stored in place, for telegram parts that are passed between
+// tasks and functions without allocating
+template <size_t N>
+class InlineBytes {
+ public:
+  static constexpr size_t CAPACITY = N;
+
+  // Copies at most N bytes, returns false if bytes were cut off
+  bool assign(ByteView view) {
+    len = std::min(view.size(), N);
+    std::copy(view.begin(), view.begin() + len, bytes);
+    return len == view.size();
+  }
+
+  operator ByteView() const { return ByteView(bytes, len); }
+
+  const uint8_t* data() const { return bytes; }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+
+  uint8_t operator[](size_t i) const { return bytes[i]; }
+
+ private:
+  uint8_t bytes[N];
+  size_t len = 0;
+};
+
+using MasterBytes = InlineBytes<TELEGRAM_MASTER_MAX>;
+using SlaveBytes = InlineBytes<TELEGRAM_SLAVE_MAX>;
+
+// Writes the bytes as hex like ebus::to_string, cut off to fit into size
+// including the terminating zero. Returns the number of characters written.
+inline size_t toHex(ByteView view, char* out, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+  size_t pos = 0;
+  for (uint8_t byte : view) {
+    if (pos + 3 > size) break;
+    out[pos++] = digits[byte >> 4];
+    out[pos++] = digits[byte & 0x0f];
+  }
+  if (size > 0) out[pos] = '\0';
+  return pos;
+}
+
+inline std::string toHex(ByteView view) {
+  std::string hex(2 * view.size() + 1, '\0');
+  hex.resize(toHex(view, &hex[0], hex.size()));
+  return hex;
+}
@@ -3,43 +3,259 @@
 #include <WiFiClient.h>
 #include <WiFiServer.h>
 
-bool handleNewClient(WiFiServer* server, WiFiClient clients[]);
+#include "broadcast.hpp"
+#include "bus.hpp"
+
+// Bus data goes to all clients through one ring. Every client has its own read
+// cursor and is drained in chunks as far as its socket takes them without
+// blocking. A client is drained on SYN, when CLIENT_DRAIN_RECORDS records are
+// pending or when its oldest pending record is older than CLIENT_FLUSH_MICROS,
+// which can be overridden with a build flag. A client that falls behind by
+// more than the ring size gets an overflow marker instead of the lost records.
+#ifndef CLIENT_FLUSH_MICROS
+#define CLIENT_FLUSH_MICROS 2000
+#endif
+#define CLIENT_DRAIN_RECORDS 32
 
-void handleClient(WiFiClient* client);
-int pushClient(WiFiClient* client, uint8_t byte);
+// Must be a power of two; 8 bytes per entry
+#define CLIENT_RING_SIZE 256
+
+// Bytes read from a client socket in one go
+#define CLIENT_READ_SIZE 64
+
+// Socket writes of all clients of one port
+struct PortStatistics {
+  uint32_t packets = 0;
+  uint32_t bytes = 0;
+  uint32_t packetsPerSecond = 0;
+  uint32_t lastPackets = 0;
+  uint32_t dropped = 0;  // records lost by lagging clients
+};
 
+// Writes to the client without blocking. Returns the number of bytes taken by
+// the socket or -1 if the connection failed.
+int sendClient(WiFiClient* client, const uint8_t* data, size_t len);
+
+bool handleNewClient(WiFiServer* server, WiFiClient clients[]);
+
+int handleClient(WiFiClient* client);
 void handleClientEnhanced(WiFiClient* client);
-int pushClientEnhanced(WiFiClient* client, uint8_t c, uint8_t d, bool log);
+
+#if !defined(EBUS_INTERNAL)
+typedef BroadcastRing<BusType::data, CLIENT_RING_SIZE> ClientRing;
+typedef ClientRing::Cursor ClientCursor;
+
+bool drainDue(const ClientRing& ring, const ClientCursor& cursor,
+              uint32_t now);
+int drainClient(WiFiClient* client, const ClientRing& ring,
+                ClientCursor& cursor, PortStatistics& statistics);
+int drainClientEnhanced(WiFiClient* client, const ClientRing& ring,
+                        ClientCursor& cursor, PortStatistics& statistics,
+                        uint8_t slot);
+#endif
 
 #if defined(EBUS_INTERNAL)
 #include <Ebus.h>
 
+#include <atomic>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "filter.hpp"
+#include "histogram.hpp"
+#include "waiter.hpp"
+
+// The client manager sleeps until a bus byte, a bus request or client data
+// arrives. It wakes up at least this often to accept new clients, and this
+// often while a client is behind because its socket is full.
+#define CLIENT_WAIT_MICROS 10000
+#define CLIENT_RETRY_MICROS 1000
+
 // C++11 compatible make_unique
 template <class T, class... Args>
 std::unique_ptr<T> make_unique(Args&&... args) {
   return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
 
+class AbstractClient;
+
+// Bus byte in the client ring; skip is the client that got it already
+struct ClientByte {
+  uint8_t byte;
+  const AbstractClient* skip;
+};
+
+typedef BroadcastRing<ClientByte, CLIENT_RING_SIZE> ClientByteRing;
+
+// Bytes a client may have waiting for its socket besides the bus bytes in the
+// ring, e.g. responses of the enhanced protocol or telegram frames. A client
+// whose backlog overflows is disconnected, a telegram client loses the frame.
+#define CLIENT_BACKLOG_SIZE 256
+
+// Read-only port with one binary frame per telegram. All numbers are little
+// endian:
+//   offset  size  content
+//   0       2     length of the rest of the frame
+//   2       4     micros() when the telegram was complete
+//   6       1     ebus::MessageType, 0xff for errors
+//   7       1     ebus::TelegramType, 0xff for errors
+//   8       1     status: 0 telegram, 1 error
+//   9       1     m, number of master bytes
+//   10      m     master bytes
+//   10+m    1     s, number of slave bytes
+//   11+m    s     slave bytes
+#define CLIENT_TELEGRAM_PORT 3336
+#define TELEGRAM_FRAME_BYTES 32  // master or slave bytes, more are cut off
+#define TELEGRAM_FRAME_MAX (11 + 2 * TELEGRAM_FRAME_BYTES)
+// Frames from the telegram callback to the client manager; must be a power of
+// two
+#define TELEGRAM_QUEUE_SIZE 16
+
+enum telegramStatus { TELEGRAM_OK = 0, TELEGRAM_ERROR = 1 };
+
+struct TelegramFrame {
+  uint32_t sequence;  // set by pushTelegram, not part of the frame
+  uint8_t len;
+  uint8_t data[TELEGRAM_FRAME_MAX];
+};
+
+// Builds the frame of a telegram, messageType and telegramType as numbers
+void encodeTelegram(TelegramFrame& frame, uint32_t time, uint8_t messageType,
+                    uint8_t telegramType, uint8_t status,
+                    const std::vector<uint8_t>& master,
+                    const std::vector<uint8_t>& slave);
+
+// How the client manager picks the next client with data for the bus:
+// - RoundRobin : in turn, starting after the client served last
+// - Weighted   : in turn, but clients of a port get its weight of turns
+// - Fifo       : the client that has been waiting the longest
+enum class ClientPolicy { RoundRobin, Weighted, Fifo };
+
+#ifndef CLIENT_POLICY
+#define CLIENT_POLICY ClientPolicy::RoundRobin
+#endif
+
+// Turns per port for ClientPolicy::Weighted
+#ifndef CLIENT_WEIGHT_REGULAR
+#define CLIENT_WEIGHT_REGULAR 1
+#endif
+#ifndef CLIENT_WEIGHT_ENHANCED
+#define CLIENT_WEIGHT_ENHANCED 1
+#endif
+
+// Bus access of a client, kept by the client manager
+struct ClientAccess {
+  int32_t weight = 1;
+  int32_t credit = 0;      // of the weighted selection
+  bool waiting = false;    // has data for the bus
+  uint32_t since = 0;      // micros() when the data was seen first
+  uint32_t granted = 0;    // transactions started
+  uint64_t waitTotal = 0;  // micros waited for the granted transactions
+  uint32_t waitMax = 0;
+  uint32_t bytes = 0;  // bytes sent to the bus
+};
+
+// Bytes the active client sent ahead, written to the bus by the byte listener
+// as soon as the echo of the previous byte arrives; must be a power of two
+#define CLIENT_TRANSMIT_SIZE 64
+
+// Gaps between the bus bytes of a transaction of a client, in micros
+typedef Histogram<4096, 256> TransmitGaps;
+
+// Filter of a read-only client, see filter.hpp
+struct ClientFilter {
+  bool active = false;
+  uint8_t slot = 0;  // bit in the filter table
+  FilterSpec spec;
+  uint32_t forwarded = 0;  // bytes sent to the client
+  uint32_t saved = 0;      // bytes of telegrams the filter rejected
+};
+
+// Longest telegram, including escapes, that filtered clients get. Longer
+// telegrams go to none of them and are counted apart from the saved bytes.
+#define FILTER_TELEGRAM_MAX 64
+
+// Bus byte with the time the byte listener got it
+struct TimedByte {
+  uint8_t byte;
+  uint32_t time;
+};
+
+// Micros from the byte listener until the oldest byte of a write was taken
+// by the socket of a client
+typedef Histogram<0, 256> ClientLatency;
+
 // Abstract base class for all client types
 class AbstractClient {
  public:
   AbstractClient(WiFiClient* client, ebus::Request* request, bool write);
+  virtual ~AbstractClient() = default;
 
   virtual bool available() const = 0;
   virtual bool readByte(uint8_t& byte) = 0;
-  virtual bool writeBytes(const std::vector<uint8_t>& bytes) = 0;
+  // Writes len bytes without any temporary allocation
+  virtual bool writeBytes(const uint8_t* bytes, size_t len) = 0;
   virtual bool handleBusData(const uint8_t& byte) = 0;
+  virtual const char* type() const = 0;
 
   bool isWriteCapable() const;
   bool isConnected() const;
   void stop();
 
+  // Writes the bus bytes this client has not seen yet without blocking and
+  // adds the latency of the write. Returns the number of bytes the client
+  // lost by lagging behind.
+  uint32_t drain(const ClientByteRing& ring, ClientLatency& latency);
+  void resetCursor(const ClientByteRing& ring);
+  // Bytes left over, e.g. because the socket was full
+  bool behind(const ClientByteRing& ring) const;
+
+  // Wake up the waiter when the client sent data
+  void watch(SocketWaiter& waiter) const;
+
+  ClientAccess access;
+  ClientFilter filter;
+
+  // Reads a filter spec sent by the client. Returns true if the filter
+  // changed.
+  virtual bool readFilter();
+
+  // Telegram frames, only taken by clients of the telegram port
+  virtual bool writeFrame(const TelegramFrame& frame);
+
+  // Send state for the statistics
+  virtual uint32_t dropped() const;
+  size_t backlog() const;
+  size_t backlogMax() const;
+  bool overflowed() const;
+
  protected:
   WiFiClient* client;
   ebus::Request* request;
   bool write;
+
+  ClientByteRing::Cursor cursor;
+
+  // Bytes for the socket, written without blocking by drain. The ring is
+  // only drained once the backlog is empty, so the order of the bytes is
+  // kept.
+  uint8_t backlogBuffer[CLIENT_BACKLOG_SIZE];
+  size_t backlogLen = 0;
+  size_t backlogPeak = 0;
+  bool backlogOverflow = false;
+
+  // Queues bytes for the socket. Disconnects the client and returns false if
+  // the backlog overflows.
+  bool send(const uint8_t* data, size_t len);
+  size_t backlogFree() const;
+  // Hands the backlog to the socket as far as it takes it. Returns true if
+  // the backlog is empty.
+  bool flush();
+
+  // Encode a bus byte and the overflow marker for the client
+  virtual size_t encodeByte(uint8_t byte, uint8_t* out) const;
+  virtual size_t encodeOverrun(uint8_t* out) const;
 };
 
 // ReadOnly client: only sends, never receives
@@ -49,8 +265,18 @@ class ReadOnlyClient : public AbstractClient {
 
   bool available() const override;
   bool readByte(uint8_t& byte) override;
-  bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t len) override;
   bool handleBusData(const uint8_t& byte) override;
+  const char* type() const override;
+  bool readFilter() override;
+
+ protected:
+  // A filtered client gets whole telegrams instead of the ring
+  size_t encodeByte(uint8_t byte, uint8_t* out) const override;
+
+ private:
+  char line[FILTER_SPEC_MAX];
+  size_t lineLen = 0;
 };
 
 // Regular client: 1 byte per message
@@ -60,8 +286,33 @@ class RegularClient : public AbstractClient {
 
   bool available() const override;
   bool readByte(uint8_t& byte) override;
-  bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t len) override;
   bool handleBusData(const uint8_t& byte) override;
+  const char* type() const override;
+};
+
+// Telegram client: only sends, one frame per telegram and no bus bytes
+class TelegramClient : public AbstractClient {
+ public:
+  TelegramClient(WiFiClient* client, ebus::Request* request);
+
+  bool available() const override;
+  bool readByte(uint8_t& byte) override;
+  bool writeBytes(const uint8_t* bytes, size_t len) override;
+  bool handleBusData(const uint8_t& byte) override;
+  const char* type() const override;
+
+  // Queues a whole frame or nothing, so the stream stays in sync
+  bool writeFrame(const TelegramFrame& frame) override;
+  // Frames lost because the backlog was full
+  uint32_t dropped() const override;
+
+ protected:
+  size_t encodeByte(uint8_t byte, uint8_t* out) const override;
+  size_t encodeOverrun(uint8_t* out) const override;
+
+ private:
+  uint32_t frameDrops = 0;
 };
 
 // Enhanced client: 1 or 2 bytes per message (protocol encoding/decoding)
@@ -71,8 +322,16 @@ class EnhancedClient : public AbstractClient {
 
   bool available() const override;
   bool readByte(uint8_t& byte) override;
-  bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t len) override;
   bool handleBusData(const uint8_t& byte) override;
+  const char* type() const override;
+
+  // Writes a command of the enhanced protocol
+  bool writeCommand(uint8_t cmd, uint8_t data);
+
+ protected:
+  size_t encodeByte(uint8_t byte, uint8_t* out) const override;
+  size_t encodeOverrun(uint8_t* out) const override;
 };
 
 class ClientManager {
@@ -84,12 +343,54 @@ class ClientManager {
 
   void stop();
 
+  // Bus bytes lost by lagging clients
+  uint32_t dropped() const;
+
+  const ClientLatency& latency() const;
+  const TransmitGaps& transmitGaps() const;
+
+  void setPolicy(ClientPolicy policy);
+
+  // Hands a telegram to the telegram port and the multicast sender, called
+  // from the telegram and error callbacks of the handler. Numbers the frame,
+  // also when it is lost to a full queue.
+  void pushTelegram(TelegramFrame& frame);
+
+  // Send state of every client
+  const std::string getClientsJson();
+
  private:
+  // The host tests drive the steps of the task one by one
+  friend struct ClientManagerTest;
+
   WiFiServer readonlyServer;
   WiFiServer regularServer;
   WiFiServer enhancedServer;
+  WiFiServer telegramServer;
+
+  RingBuffer<TelegramFrame, TELEGRAM_QUEUE_SIZE> telegramQueue;
+  std::atomic<uint32_t> telegramOverflows{0};
+  uint32_t telegramSequence = 0;
+
+  ebus::Queue<TimedByte>* clientByteQueue = nullptr;
+  std::atomic<bool> busBytes{false};
+  std::atomic<bool> busReleased{false};  // the arbiter freed the bus
+  ClientByteRing clientRing;
+  std::atomic<uint32_t> droppedBytes{0};
+  ClientLatency byteLatency;
+  SocketWaiter waiter;
 
-  ebus::Queue<uint8_t>* clientByteQueue = nullptr;
+  // Transmit continuation, shared by the task and the byte listener. The
+  // task fills transmitQueue, whoever moves transmitState from idle to
+  // writing pops the next byte and writes it; the echo makes it idle again.
+  enum TransmitState : uint8_t { transmitIdle, transmitWriting, transmitEcho };
+  RingBuffer<uint8_t, CLIENT_TRANSMIT_SIZE> transmitQueue;
+  std::atomic<uint8_t> transmitState{transmitIdle};
+  std::atomic<bool> transmitArmed{false};  // the active client won the bus
+  // Time of the previous byte of the transaction, 0 before its first byte;
+  // reset by the task, read and written by the byte listener
+  std::atomic<uint32_t> lastByteTime{0};
+  TransmitGaps gaps;
   volatile bool stopRunner = false;
   volatile bool busRequested = false;
 
@@ -97,14 +398,49 @@ class ClientManager {
   ebus::ServiceRunnerFreeRtos* serviceRunner = nullptr;
 
   std::vector<std::unique_ptr<AbstractClient>> clients;
+  // Guards clients against the statistics read by other tasks
+  SemaphoreHandle_t clientsMutex = nullptr;
+  uint32_t overflowDisconnects = 0;
+
+  // Filters of the read-only clients and the telegram they are applied to
+  FilterTable filterTable;
+  uint8_t filterBuffer[FILTER_TELEGRAM_MAX];
+  size_t filterLen = 0;
+  bool filterOverflow = false;
+  uint32_t filterOverflows = 0;  // telegrams too long for the filters
+  bool filtersChanged = false;   // a filtered client came or went
+
+  ClientPolicy policy = CLIENT_POLICY;
+  size_t nextClient = 0;  // where the round robin continues
 
   enum class BusState { Idle, Request, Transmit, Response };
 
   TaskHandle_t clientManagerTaskHandle;
 
   static void taskFunc(void* arg);
+  static bool busBytesQueued();
+  static void arbiterReleased();
+  static bool transmitReleased();
 
   void acceptClients();
+  uint32_t waitTimeout() const;
+
+  // Picks the client that gets the bus next, nullptr if none has data
+  AbstractClient* selectClient();
+
+  // Reads new filter specs and compiles the filter table, also after a
+  // filtered client was removed
+  void updateFilters();
+  // Collects the telegram and sends it to the filtered clients on SYN
+  void filterByte(uint8_t byte);
+
+  // Called by the byte listener for every bus byte
+  void onBusByte(uint8_t byte, uint32_t time);
+  // Writes the next byte of transmitQueue if the bus is ready for it
+  void continueTransmit();
+  // Ends the transmit continuation and discards the bytes left over. Sleeps
+  // on the waiter while the byte listener is writing.
+  void endTransmit();
 };
 
 extern ClientManager clientManager;
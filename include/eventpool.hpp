@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ringbuffer.hpp"
+
+// Fixed pool of N events that a producer hands to a consumer task through a
+// queue of pointers, so passing an event needs no heap. The producer takes an
+// event, fills it and queues it; the consumer gives it back once processed.
+// An event the queue had no room for is kept as spare for the next take, so
+// it is not lost to the pool. A pool larger than the queue depth plus two
+// never runs dry.
+//
+// take and queue must be called from one task only, like the callbacks of
+// the ebus handler, which all run on the task of its service runner. The
+// spare is then never shared and the free list has one consumer.
+template <typename T, size_t N>
+class EventPool {
+ public:
+  EventPool() {
+    for (T& event : _events) _free.push(&event);
+  }
+
+  // Called by the producer. Returns nullptr if all events are in use.
+  T* take() {
+    T* event = _spare;
+    _spare = nullptr;
+    if (!event && !_free.pop(event)) {
+      _exhausted++;
+      return nullptr;
+    }
+    return event;
+  }
+
+  // Called by the producer with a taken event. Queue needs a non-blocking
+  // try_push, like ebus::Queue.
+  template <typename Queue>
+  void queue(Queue& queue, T* event) {
+    if (queue.try_push(event)) return;
+    _dropped++;
+    _spare = event;
+  }
+
+  // Called by the consumer when it is done with an event
+  void give(T* event) { _free.push(event); }
+
+  size_t free() const { return _free.size(); }
+  uint32_t dropped() const { return _dropped; }      // queue full
+  uint32_t exhausted() const { return _exhausted; }  // no free event
+
+ private:
+  T _events[N];
+  RingBuffer<T*, N> _free;
+  T* _spare = nullptr;
+  std::atomic<uint32_t> _dropped{0};
+  std::atomic<uint32_t> _exhausted{0};
+};
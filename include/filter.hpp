@@ -0,0 +1,53 @@
+#pragma once
+
+#if defined(EBUS_INTERNAL)
+#include <cstddef>
+#include <cstdint>
+
+// Read-only clients may send a filter spec as one line of JSON, e.g.
+//   {"QQ":["10","31"],"ZZ":["08"],"PBSB":["b509","07"]}
+// QQ and ZZ list source and target addresses, PBSB lists prefixes of the
+// primary and secondary command, either PB alone or PB and SB. A missing or
+// empty list matches everything. Such a client then only gets the telegrams
+// that match, each followed by SYN.
+#define FILTER_SPEC_MAX 256  // longest spec line
+#define FILTER_PBSB_MAX 8    // prefixes per spec
+#define FILTER_SLOTS 32      // filtered clients, one bit each
+
+struct FilterSpec {
+  bool anyQQ = true;
+  bool anyZZ = true;
+  uint32_t qq[8] = {};  // bit per address
+  uint32_t zz[8] = {};
+  uint8_t prefixes = 0;
+  uint16_t pbsb[FILTER_PBSB_MAX] = {};  // PB in the high byte
+  uint16_t mask[FILTER_PBSB_MAX] = {};  // 0xff00 for PB only
+
+  // Returns false if the line is no valid spec
+  bool parse(const char* line);
+};
+
+// The filters of all clients compiled into tables with one bit per client
+// slot, so a telegram is matched once for all clients
+class FilterTable {
+ public:
+  void clear();
+  void add(uint8_t slot, const FilterSpec& spec);
+
+  // Slots of the clients that want the telegram
+  uint32_t match(uint8_t qq, uint8_t zz, uint8_t pb, uint8_t sb) const;
+
+ private:
+  uint32_t qq[256] = {};
+  uint32_t zz[256] = {};
+  uint32_t anyPbsb = 0;  // slots without prefixes
+
+  struct Prefix {
+    uint16_t pbsb;
+    uint16_t mask;
+    uint32_t slots;
+  };
+  Prefix prefixes[FILTER_SLOTS * FILTER_PBSB_MAX];
+  size_t count = 0;
+};
+#endif
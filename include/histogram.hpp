@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Width of a histogram bin in micros
+#define HISTOGRAM_BIN_MICROS 16
+
+// Histogram with N fixed bins of HISTOGRAM_BIN_MICROS, the first one starting
+// at Min. Values outside of the bins are only counted. Filled by one task
+// without locking, other tasks may read it at any time; the counts of a read
+// are not necessarily consistent with each other.
+template <int32_t Min, size_t N>
+class Histogram {
+ public:
+  static constexpr int32_t MIN = Min;
+  static constexpr int32_t WIDTH = HISTOGRAM_BIN_MICROS;
+  static constexpr size_t BINS = N;
+
+  void add(int32_t value) {
+    if (value < Min) {
+      increment(_below);
+    } else if (value >= Min + static_cast<int32_t>(N) * WIDTH) {
+      increment(_above);
+    } else {
+      increment(_bins[(value - Min) / WIDTH]);
+    }
+  }
+
+  uint32_t bin(size_t i) const {
+    return _bins[i].load(std::memory_order_relaxed);
+  }
+  uint32_t below() const { return _below.load(std::memory_order_relaxed); }
+  uint32_t above() const { return _above.load(std::memory_order_relaxed); }
+
+  uint32_t count() const {
+    uint32_t count = below() + above();
+    for (size_t i = 0; i < N; i++) count += bin(i);
+    return count;
+  }
+
+ private:
+  std::atomic<uint32_t> _bins[N] = {};
+  std::atomic<uint32_t> _below{0};
+  std::atomic<uint32_t> _above{0};
+
+  // single writer, so no read-modify-write is needed
+  static void increment(std::atomic<uint32_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+};
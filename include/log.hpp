@@ -2,5 +2,9 @@
 
 #include <Arduino.h>
 
-void addLog(String entry);
+// Longest log entry including the timestamp, longer entries are cut off
+#define LOG_ENTRY_LEN 160
+
+void addLog(const char* entry);
+inline void addLog(const String& entry) { addLog(entry.c_str()); }
 String getLog();
@@ -3,6 +3,7 @@
 #include <WiFiClient.h>
 #include <WiFiServer.h>
 
+#include <atomic>
 #include <string>
 
 #define MAX_WIFI_CLIENTS 4
@@ -15,6 +16,9 @@
 #endif
 #define AVAILABLE_THRESHOLD 0  // https://esp32.com/viewtopic.php?t=19788
 
+// Counters written by one task and read by others
+#define ATOMIC_INT std::atomic<int>
+
 inline int DEBUG_LOG(const char* format, ...) { return 0; }
 int DEBUG_LOG_IMPL(const char* format, ...);
 // #define DEBUG_LOG DEBUG_LOG_IMPL
@@ -22,4 +26,7 @@ int DEBUG_LOG_IMPL(const char* format, ...);
 char* status_string();
 void restart();
 const std::string getStatusJson();
+#if !defined(EBUS_INTERNAL)
+const std::string getArbitrationJson();
+#endif
 void updateLastComms();
@@ -84,9 +84,8 @@ class Mqtt {
 
   static void enqueueOutgoing(const OutgoingAction& action);
 
-  static void publishData(const std::string& id,
-                          const std::vector<uint8_t>& master,
-                          const std::vector<uint8_t>& slave);
+  static void publishData(const std::string& id, ByteView master,
+                          ByteView slave);
 
   static void publishValue(const Command* command, const JsonDocument& doc);
 
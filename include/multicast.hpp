@@ -0,0 +1,52 @@
+#pragma once
+
+#if defined(EBUS_INTERNAL)
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Sends every telegram once as a UDP datagram to a multicast group (or a
+// broadcast address), so any number of listeners costs the same as one. All
+// numbers are little endian:
+//   offset  size  content
+//   0       4     sequence number, one per telegram, gaps mean lost telegrams
+//   4       n     frame of the telegram port without its length, see
+//                 CLIENT_TELEGRAM_PORT
+#define MULTICAST_GROUP "239.255.60.60"
+#define MULTICAST_PORT 3337
+#ifndef MULTICAST_TTL
+#define MULTICAST_TTL 1  // stay in the local network
+#endif
+
+struct TelegramFrame;
+
+class TelegramMulticast {
+ public:
+  // Called from any task, the socket follows with the next telegram
+  void setEnabled(bool enabled);
+  // Returns false if address is no IPv4 address
+  bool setGroup(const char* address, uint16_t port);
+
+  bool isEnabled() const;
+
+  // Called by the client manager task only
+  void send(const TelegramFrame& frame);
+
+  uint32_t sent() const;
+  uint32_t failed() const;
+
+ private:
+  std::atomic<bool> enabled{false};
+  std::atomic<uint32_t> group{0};  // network byte order
+  std::atomic<uint16_t> port{MULTICAST_PORT};
+
+  int sock = -1;
+  std::atomic<uint32_t> sentDatagrams{0};
+  std::atomic<uint32_t> failedDatagrams{0};
+
+  bool openSocket();
+  void closeSocket();
+};
+
+extern TelegramMulticast multicast;
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free ring buffer for exactly one producer and one consumer. Producer
+// and consumer may run in different tasks: the producer only moves _head, the
+// consumer only moves _tail. The indexes run freely and are masked on access,
+// so the capacity must be a power of two.
+template <typename T, size_t N>
+class RingBuffer {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  // Called by the producer. Returns false if the buffer is full.
+  bool push(const T& value) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) == N) return false;
+    _buffer[head & (N - 1)] = value;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Called by the consumer. Returns false if the buffer is empty.
+  bool pop(T& value) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (_head.load(std::memory_order_acquire) == tail) return false;
+    value = _buffer[tail & (N - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Called by the consumer. Like pop, but leaves the value in the buffer.
+  bool peek(T& value) const {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (_head.load(std::memory_order_acquire) == tail) return false;
+    value = _buffer[tail & (N - 1)];
+    return true;
+  }
+
+  size_t size() const {
+    return _head.load(std::memory_order_acquire) -
+           _tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T _buffer[N];
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
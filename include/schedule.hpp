@@ -5,11 +5,14 @@
 #include <Ebus.h>
 #include <WiFiClient.h>
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
+#include "bytes.hpp"
+#include "eventpool.hpp"
 #include "store.hpp"
 
 // Active commands are sent on the eBUS at scheduled intervals, and the received
@@ -21,6 +24,19 @@
 
 constexpr uint8_t VENDOR_VAILLANT = 0xb5;
 
+// Callback events wait in a queue of this depth for the schedule task. They
+// come from a fixed EventPool that must be a power of two.
+#ifndef SCHEDULE_EVENT_QUEUE_SIZE
+#define SCHEDULE_EVENT_QUEUE_SIZE 8
+#endif
+#ifndef SCHEDULE_EVENT_POOL_SIZE
+#define SCHEDULE_EVENT_POOL_SIZE 16
+#endif
+
+// Longer error texts are cut off, as are telegram parts longer than
+// TELEGRAM_MASTER_MAX and TELEGRAM_SLAVE_MAX
+#define SCHEDULE_EVENT_ERROR_MAX 48
+
 struct Participant {
   uint8_t slave;
   std::vector<uint8_t> vec_070400;
@@ -41,7 +57,7 @@ struct Participant {
 
 class Schedule {
  public:
-  Schedule() = default;
+  Schedule();
 
   void start(ebus::Request* request, ebus::Handler* handler);
   void stop();
@@ -111,6 +127,11 @@ class Schedule {
   uint32_t scheduleCommandSetTime = 0;  // time when command was scheduled
   uint32_t scheduleCommandTimeout = 2 * 1000;  // 2 seconds after schedule
 
+  // the arbiter was acquired for the active message in flight, and the
+  // request of the handler has been seen busy with it since
+  bool arbiterHeld = false;
+  bool activeRequested = false;
+
   uint32_t distanceCommands = 0;     // in milliseconds
   uint32_t lastCommand = 10 * 1000;  // 10 seconds after start
 
@@ -138,21 +159,31 @@ class Schedule {
     struct {
       ebus::MessageType messageType;
       ebus::TelegramType telegramType;
-      std::vector<uint8_t> master;
-      std::vector<uint8_t> slave;
-      std::string error;
+      MasterBytes master;
+      SlaveBytes slave;
+      char error[SCHEDULE_EVENT_ERROR_MAX];
     } data;
   };
 
-  ebus::Queue<CallbackEvent*> eventQueue{8};
+  // The callbacks take events from the pool, the schedule task gives them
+  // back after processing
+  EventPool<CallbackEvent, SCHEDULE_EVENT_POOL_SIZE> events;
+
+  ebus::Queue<CallbackEvent*> eventQueue{SCHEDULE_EVENT_QUEUE_SIZE};
 
   TaskHandle_t scheduleTaskHandle;
 
   static void taskFunc(void* arg);
 
+  // Called from the callbacks of the handler
+  CallbackEvent* takeEvent(CallbackType type, ByteView master, ByteView slave);
+  void queueEvent(CallbackEvent* event);
+
   void handleEvents();
 
   void handleCommands();
+  void releaseArbiter();
+  static void arbiterReleased();
 
   void enqueueCommand(const QueuedCommand& cmd);
 
@@ -165,14 +196,11 @@ class Schedule {
   static void reactiveMasterSlaveCallback(const std::vector<uint8_t>& master,
                                           std::vector<uint8_t>* const slave);
 
-  void processActive(const Mode& mode, const std::vector<uint8_t>& master,
-                     const std::vector<uint8_t>& slave);
+  void processActive(const Mode& mode, ByteView master, ByteView slave);
 
-  void processPassive(const std::vector<uint8_t>& master,
-                      const std::vector<uint8_t>& slave);
+  void processPassive(ByteView master, ByteView slave);
 
-  void processScan(const std::vector<uint8_t>& master,
-                   const std::vector<uint8_t>& slave);
+  void processScan(ByteView master, ByteView slave);
 };
 
 extern Schedule schedule;
@@ -5,10 +5,13 @@
 #include <Ebus.h>
 
 #include <functional>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "bytes.hpp"
+
 // This Store class stores both active and passive eBUS commands. For permanent
 // storage (NVS), functions for saving, loading, and deleting commands are
 // available. Permanently stored commands are automatically loaded when the
@@ -113,11 +116,17 @@ class Store {
   const bool active() const;
 
   Command* nextActiveCommand();
-  std::vector<Command*> findPassiveCommands(const std::vector<uint8_t>& master);
-
-  std::vector<Command*> updateData(Command* command,
-                                   const std::vector<uint8_t>& master,
-                                   const std::vector<uint8_t>& slave);
+  // Returns a reference to a vector owned by the store, which is refilled by
+  // the next call of findPassiveCommands or updateData. Both are only called
+  // from the schedule task, so copy the commands before passing them on.
+  const std::vector<Command*>& findPassiveCommands(ByteView master);
+
+  // Stores the data of the telegram in the command, or in the passive
+  // commands that match if command is nullptr. Returns the updated commands in
+  // the same vector as findPassiveCommands, with the same lifetime. Once the
+  // buffers have grown to their size this does not allocate.
+  const std::vector<Command*>& updateData(Command* command, ByteView master,
+                                          ByteView slave);
 
   static JsonDocument getValueJson(const Command* command);
   static const std::string getValueFullJson(const Command* command);
@@ -132,6 +141,10 @@ class Store {
   // For active commands, just keep a vector of pointers
   std::vector<Command*> activeCommands;
 
+  // Reused by every telegram
+  std::vector<uint8_t> lookupKey;
+  std::vector<Command*> foundCommands;
+
   static const std::string isFieldValid(const JsonDocument& doc,
                                         const std::string& field, bool required,
                                         FieldType type);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "main.hpp"
+
+// Follows the telegrams on the bus, checks their CRCs and keeps statistics
+// about them. Fed with every symbol received by the serial task through
+// BusState, which also asks it when the running telegram ends. The work per
+// symbol is a table lookup and a few counter updates only.
+class TelegramDecoder {
+ public:
+  // eBUS CRC8 with polynomial 0x9B, computed over the symbols as they are on
+  // the bus, i.e. including escape sequences
+  static uint8_t crc8(uint8_t crc, uint8_t symbol);
+
+  void data(uint8_t symbol);
+
+  // The running telegram is complete, so the next symbol should be the SYN
+  bool done() const { return _part == pDone; }
+
+  // Minimum number of symbols until the running telegram is complete, -1 if
+  // no telegram is followed. The slave part is counted with the shortest
+  // possible response until its length is known.
+  int remaining() const;
+
+  // Read by other tasks for the status
+  ATOMIC_INT _telegrams{0};       // complete telegrams
+  ATOMIC_INT _broadcast{0};       // of which broadcast
+  ATOMIC_INT _masterMaster{0};    // of which master master
+  ATOMIC_INT _masterSlave{0};     // of which master slave
+  ATOMIC_INT _crcErrors{0};       // CRC of the master part wrong
+  ATOMIC_INT _slaveCrcErrors{0};  // CRC of the slave part wrong
+  ATOMIC_INT _naks{0};            // master part not acknowledged by the target
+  ATOMIC_INT _slaveNaks{0};       // slave part not acknowledged by the master
+  ATOMIC_INT _aborted{0};         // SYN or invalid data before the end
+  uint32_t _sizes[17] = {};      // complete telegrams by NN of the master part
+  uint32_t _sources[256] = {};   // complete telegrams by QQ
+  uint32_t _targets[256] = {};   // complete telegrams by ZZ
+
+ private:
+  enum part {
+    pIdle,  // waiting for a SYN
+    pQQ,
+    pZZ,
+    pPB,
+    pSB,
+    pNN,
+    pData,
+    pCRC,
+    pAck,
+    pSlaveNN,
+    pSlaveData,
+    pSlaveCRC,
+    pSlaveAck,
+    pDone  // telegram complete, waiting for SYN
+  };
+
+  part _part = pIdle;
+  bool _escaped = false;
+  uint8_t _crc = 0;
+  uint8_t _count = 0;  // data bytes still to come
+  uint8_t _qq = 0;
+  uint8_t _zz = 0;
+  uint8_t _nn = 0;
+
+  void complete();
+  void abort();
+};
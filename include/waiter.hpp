@@ -0,0 +1,33 @@
+#pragma once
+
+#include <WiFiClient.h>
+#include <sys/select.h>
+
+#include <atomic>
+
+// Lets a task sleep until one of its client sockets becomes readable, another
+// task calls signal() or a timeout expires. The signal is an eventfd, so it
+// wakes up the same select() as the sockets.
+class SocketWaiter {
+ public:
+  bool begin();
+  void end();
+
+  // Called from any task. The eventfd is only written while the owner waits.
+  void signal();
+
+  // Socket set of the next wait, called by the owning task
+  void clear();
+  void add(WiFiClient* client);
+
+  // Sleeps until a socket is readable, signal() is called or timeoutMicros
+  // expired. ready is checked after the signal has been armed, so work that
+  // arrives in between is not missed. Returns false on timeout.
+  bool wait(uint32_t timeoutMicros, bool (*ready)());
+
+ private:
+  int _event = -1;
+  std::atomic<bool> _waiting{false};
+  fd_set _fds;
+  int _maxFd = -1;
+};
@@ -0,0 +1,178 @@
+#if defined(EBUS_INTERNAL)
+#include "arbiter.hpp"
+
+#include <ArduinoJson.h>
+
+BusArbiter arbiter;
+
+BusArbiter::BusArbiter() : mutex(xSemaphoreCreateMutex()) {
+  configure(BusSource::client, ARBITER_PRIORITY_CLIENT, ARBITER_QUOTA_CLIENT);
+  configure(BusSource::schedule, ARBITER_PRIORITY_SCHEDULE,
+            ARBITER_QUOTA_SCHEDULE);
+}
+
+void BusArbiter::configure(BusSource source, uint8_t priority, uint8_t quota) {
+  Source& s = sources[static_cast<int>(source)];
+  s.priority = priority;
+  s.quota = quota > 100 ? 100 : quota;
+}
+
+bool BusArbiter::acquire(BusSource source) {
+  int i = static_cast<int>(source);
+  Source& s = sources[i];
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  uint32_t now = micros();
+  rollWindow(now);
+
+  unsigned waiting = 0;
+  if (holder >= 0 && now - holdStart > ARBITER_HOLD_MICROS) {
+    sources[holder].timeouts++;
+    releaseLocked(now);
+    waiting = waitingLocked() & ~(1u << i);
+  }
+
+  if (holder == i) {
+    xSemaphoreGive(mutex);
+    return true;
+  }
+
+  s.lastAsk = now;
+  if (!s.waiting) {
+    s.waiting = true;
+    s.since = now;
+    s.requests++;
+  }
+
+  bool granted = holder < 0;
+  for (int j = 0; granted && j < BUS_SOURCES; j++) {
+    if (j == i || !sources[j].waiting) continue;
+    // a source that stopped asking does not hold up the others
+    if (now - sources[j].lastAsk > ARBITER_STALE_MICROS) {
+      sources[j].waiting = false;
+      continue;
+    }
+    if (before(j, i)) granted = false;
+  }
+
+  if (granted) {
+    uint32_t wait = now - s.since;
+    holder = i;
+    holdStart = now;
+    s.waiting = false;
+    s.grants++;
+    s.waitTotal += wait;
+    if (wait > s.waitMax) s.waitMax = wait;
+  }
+  xSemaphoreGive(mutex);
+  // the bus of a timed out holder went to this source, the others ask again
+  if (!granted) wake(waiting);
+  return granted;
+}
+
+void BusArbiter::release(BusSource source) {
+  unsigned waiting = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (holder == static_cast<int>(source)) {
+    releaseLocked(micros());
+    waiting = waitingLocked();
+  }
+  xSemaphoreGive(mutex);
+  wake(waiting);
+}
+
+void BusArbiter::setWakeup(BusSource source, void (*wakeup)()) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  sources[static_cast<int>(source)].wakeup = wakeup;
+  xSemaphoreGive(mutex);
+}
+
+bool BusArbiter::holds(BusSource source) const {
+  return holder == static_cast<int>(source);
+}
+
+const std::string BusArbiter::getArbiterJson() {
+  std::string payload;
+  JsonDocument doc;
+
+  const char* names[] = {"Client", "Schedule"};
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  uint32_t now = micros();
+  rollWindow(now);
+  doc["Holder"] = holder >= 0 ? names[holder] : "";
+  for (int i = 0; i < BUS_SOURCES; i++) {
+    const Source& s = sources[i];
+    JsonObject Usage = doc["Sources"][names[i]].to<JsonObject>();
+    Usage["Priority"] = s.priority;
+    Usage["Quota"] = s.quota;
+    Usage["Over_Quota"] = overQuota(s);
+    Usage["Waiting"] = s.waiting;
+    Usage["Requests"] = s.requests;
+    Usage["Grants"] = s.grants;
+    Usage["Wait_Avg"] =
+        s.grants > 0 ? static_cast<uint32_t>(s.waitTotal / s.grants) : 0;
+    Usage["Wait_Max"] = s.waitMax;
+    Usage["Bus_Time"] = static_cast<uint32_t>(s.busTotal / 1000);  // ms
+    Usage["Occupancy"] =
+        100.0f * (s.usedCurrent + s.usedPrevious) /
+        (ARBITER_WINDOW_MICROS + (now - windowStart));
+    Usage["Timeouts"] = s.timeouts;
+  }
+  xSemaphoreGive(mutex);
+
+  doc.shrinkToFit();
+  serializeJson(doc, payload);
+
+  return payload;
+}
+
+void BusArbiter::rollWindow(uint32_t now) {
+  uint32_t elapsed = now - windowStart;
+  if (elapsed < ARBITER_WINDOW_MICROS) return;
+  for (Source& s : sources) {
+    s.usedPrevious = elapsed < 2 * ARBITER_WINDOW_MICROS ? s.usedCurrent : 0;
+    s.usedCurrent = 0;
+  }
+  windowStart = now;
+}
+
+void BusArbiter::releaseLocked(uint32_t now) {
+  uint32_t held = now - holdStart;
+  sources[holder].usedCurrent += held;
+  sources[holder].busTotal += held;
+  holder = -1;
+}
+
+unsigned BusArbiter::waitingLocked() const {
+  unsigned waiting = 0;
+  for (int i = 0; i < BUS_SOURCES; i++) {
+    if (sources[i].waiting && sources[i].wakeup) waiting |= 1u << i;
+  }
+  return waiting;
+}
+
+void BusArbiter::wake(unsigned waiting) {
+  // called without the mutex, the wakeup may ask for the bus right away
+  for (int i = 0; i < BUS_SOURCES; i++) {
+    if (waiting & (1u << i)) sources[i].wakeup();
+  }
+}
+
+bool BusArbiter::overQuota(const Source& source) const {
+  // the previous window counts in full, so the span is never too short
+  uint64_t span = ARBITER_WINDOW_MICROS + (micros() - windowStart);
+  uint64_t used = source.usedCurrent + source.usedPrevious;
+  return used * 100 > span * source.quota;
+}
+
+bool BusArbiter::before(int a, int b) const {
+  const Source& sa = sources[a];
+  const Source& sb = sources[b];
+  bool overA = overQuota(sa);
+  bool overB = overQuota(sb);
+  if (overA != overB) return !overA;
+  if (sa.priority != sb.priority) return sa.priority > sb.priority;
+  return static_cast<int32_t>(sa.since - sb.since) < 0;
+}
+#endif
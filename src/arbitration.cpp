@@ -1,7 +1,148 @@
 #include "arbitration.hpp"
 
+#include <esp_timer.h>
+
 #include "bus.hpp"
 
+// Clock based on esp_timer. The timer callback runs in the esp_timer task,
+// which frees the serial task while waiting for the arbitration window.
+class EspTimerClock : public ArbitrationClock {
+ public:
+  uint32_t now() override { return micros(); }
+
+  void once(uint32_t delay, void (*fn)(void*), void* arg) override {
+    if (delay == 0) {
+      fn(arg);
+      return;
+    }
+    if (_timer == nullptr) {
+      esp_timer_create_args_t args = {};
+      args.callback = &EspTimerClock::expired;
+      args.arg = this;
+      args.dispatch_method = ESP_TIMER_TASK;
+      args.name = "arbitration";
+      if (esp_timer_create(&args, &_timer) != ESP_OK) {
+        DEBUG_LOG("esp_timer_create failed\n");
+        fn(arg);
+        return;
+      }
+    }
+    _fn = fn;
+    _arg = arg;
+    esp_timer_stop(_timer);
+    esp_timer_start_once(_timer, delay);
+  }
+
+  void cancel() override {
+    if (_timer != nullptr) esp_timer_stop(_timer);
+  }
+
+ private:
+  esp_timer_handle_t _timer = nullptr;
+  void (*_fn)(void*) = nullptr;
+  void* _arg = nullptr;
+
+  static void expired(void* arg) {
+    EspTimerClock* self = static_cast<EspTimerClock*>(arg);
+    self->_fn(self->_arg);
+  }
+};
+
+EspTimerClock espTimerClock;
+
+Arbitration::Arbitration(ArbitrationClock* clock)
+    : _clock(clock ? clock : &espTimerClock),
+      _arbitrating(false),
+      _participateSecond(false),
+      _arbitrationAddress(0),
+      _restartCount(0),
+      _prearmed(false),
+      _prearms(0),
+      _prearmMisses(0),
+      _prearmOrphans(0),
+      _send(sendIdle),
+      _writeTime(0),
+      _synStartBit(0),
+      _latencyMean(UART_LATENCY << LATENCY_SHIFT),
+      _latencyVariance(0),
+      _latencySamples(0),
+      _echoes(0),
+      _windowHits(0),
+      _delay(0),
+      _gap(0) {}
+
+void Arbitration::transmit(void* arg) {
+  Arbitration* self = static_cast<Arbitration*>(arg);
+  // a withdrawn prearm is not sent; only the serial task schedules, so the
+  // plain store after a failed exchange does not race
+  uint8_t send = sendArmed;
+  if (!self->_send.compare_exchange_strong(send, sendDone)) {
+    if (send != sendScheduled) return;
+    self->_send = sendDone;
+  }
+  self->_writeTime = self->_clock->now();
+  Bus.write(self->_arbitrationAddress);
+}
+
+void Arbitration::calibrate(uint32_t echoStartBitTime) {
+  // each written address is echoed once
+  if (_send != sendDone) return;
+  _send = sendIdle;
+  uint32_t sinceSyn = echoStartBitTime - _synStartBit;
+  _echoes++;
+  if (sinceSyn >= static_cast<uint32_t>(WINDOW_BEGIN) &&
+      sinceSyn <= static_cast<uint32_t>(WINDOW_END)) {
+    _windowHits++;
+  }
+
+  // Ignore measurements that can not be a uart latency, e.g. because the
+  // start bit time stamp belongs to another symbol
+  int32_t measured = echoStartBitTime - _writeTime;
+  if (measured < 0 || measured > WINDOW_BEGIN) return;
+
+  int32_t diff = (measured << LATENCY_SHIFT) - _latencyMean;
+  _latencyMean += diff >> LATENCY_SHIFT;
+  int64_t square = (static_cast<int64_t>(diff) * diff) >> (2 * LATENCY_SHIFT);
+  _latencyVariance += (square - _latencyVariance) >> LATENCY_SHIFT;
+  _latencySamples++;
+}
+
+int32_t Arbitration::schedule(uint32_t startBitTime) {
+  _synStartBit = startBitTime;
+  _send = _prearmed ? sendArmed : sendScheduled;
+#if USE_ASYNCHRONOUS
+  // When in async mode, we get immediately interrupted when a symbol is
+  // received on the bus The earliest allowed to send is 4300 measured from the
+  // start bit of the SYN command. We receive the exact flange of the startbit,
+  // use that to calculate the exact time to send. Then subtract time from the
+  // wait to allow the uart to put the byte on the bus. This latency is learned
+  // from the echo of our own address. Aim one standard deviation of the
+  // latency after the begin of the window, but not beyond its middle. The
+  // waiting is done by a one shot timer, so the serial task is not blocked in
+  // the meantime.
+  int32_t margin = 0;
+  while ((margin + 1) * (margin + 1) <= _latencyVariance &&
+         margin < (WINDOW_END - WINDOW_BEGIN) / 2)
+    margin++;
+  int32_t delay =
+      sendDelay(startBitTime, _clock->now(), latency() - margin);
+  _delay = delay;
+  _clock->once(delay > 0 ? delay : 0, &Arbitration::transmit, this);
+  return delay;
+#else
+  _delay = 0;
+  transmit(this);
+  return 0;
+#endif
+}
+
+void Arbitration::record(outcome o) {
+  Timing& timing = _timing[o];
+  timing.send.add(_writeTime - _synStartBit);
+  timing.delay.add(_delay);
+  timing.gap.add(_gap);
+}
+
 // arbitration is timing sensitive. avoid communicating with WifiClient during
 // arbitration according
 // https://ebus-wiki.org/lib/exe/fetch.php/ebus/spec_test_1_v1_1_1.pdf
@@ -13,6 +154,9 @@
 Arbitration::result Arbitration::start(const BusState& busstate, uint8_t master,
                                        uint32_t startBitTime) {
   static int arb = 0;
+  if (_prearmed) {
+    return not_started;
+  }
   if (_arbitrating) {
     return not_started;
   }
@@ -24,40 +168,98 @@ Arbitration::result Arbitration::start(const BusState& busstate, uint8_t master,
   }
 
   // too late if we don't have enough time to send our symbol
-  uint32_t now = micros();
+  uint32_t now = _clock->now();
   uint32_t microsSinceLastSyn = busstate.microsSinceLastSyn();
   uint32_t timeSinceStartBit = now - startBitTime;
-  if (timeSinceStartBit > 4456 || Bus.available()) {
+  if (timeSinceStartBit > static_cast<uint32_t>(WINDOW_END) ||
+      Bus.available()) {
     // if we are too late, don't try to participate and retry next round
     DEBUG_LOG("ARB LATE 0x%02x %lu us\n", BusSer.peek(), timeSinceStartBit);
+    _timing[outcomeLate].send.add(timeSinceStartBit);
     return late;
   }
-#if USE_ASYNCHRONOUS
-  // When in async mode, we get immediately interrupted when a symbol is
-  // received on the bus The earliest allowed to send is 4300 measured from the
-  // start bit of the SYN command. We receive the exact flange of the startbit,
-  // use that to calculate the exact time to wait. Then subtract time from the
-  // wait to allow the uart to put the byte on the bus. Testing has shown this
-  // requires about 700 micros on the esp32-c3.
-  int delay = 4300 - timeSinceStartBit - 700;
-  if (delay > 0) {
-    delayMicroseconds(delay);
-  }
-#endif
-  Bus.write(master);
-  // Do logging of the ARB START message after writing the symbol, so enabled or
-  // disabled logging does not affect timing calculations.
-#if USE_ASYNCHRONOUS
+  _arbitrationAddress = master;
+  _arbitrating = true;
+  _participateSecond = false;
+  int32_t delay = schedule(startBitTime);
+  // Do logging of the ARB START message after scheduling the symbol, so
+  // enabled or disabled logging does not affect timing calculations.
   DEBUG_LOG("ARB START %04i 0x%02x %lu us %i  us\n", arb++, master,
             microsSinceLastSyn, delay);
+  return started;
+}
+
+bool Arbitration::prearm(const BusState& busstate, uint8_t master,
+                         uint32_t startBitTime) {
+#if USE_ASYNCHRONOUS
+  if (_arbitrating || _prearmed || master == SYN ||
+      !busstate.telegramComplete()) {
+    return false;
+  }
+  // only for the symbol after the last one of the telegram, not for an edge
+  // of a symbol already received, and only if the address can still be
+  // handed to the uart in time
+  int32_t early = busstate.expectedFree() - startBitTime;
+  if (early >= PREARM_TOLERANCE ||
+      sendDelay(startBitTime, _clock->now(), latency()) <= 0) {
+    return false;
+  }
+  _arbitrationAddress = master;
+  _prearmed = true;
+  _prearms++;
+  schedule(startBitTime);
+  return true;
 #else
-  DEBUG_LOG("ARB START %04i 0x%02x %lu us\n", arb++, master,
-            microsSinceLastSyn);
+  return false;
 #endif
-  _arbitrationAddress = master;
+}
+
+Arbitration::prearmResult Arbitration::confirm(const BusState& busstate,
+                                               bool owner, uint8_t master,
+                                               uint32_t startBitTime) {
+  _prearmed = false;
+  bool mine = owner && master == _arbitrationAddress;
+  int32_t drift = startBitTime - _synStartBit;
+  bool miss = busstate._state != BusState::eReceivedFirstSYN ||
+              drift <= -PREARM_TOLERANCE || drift >= PREARM_TOLERANCE;
+  if (miss) _prearmMisses++;
+  // Usually the timer handed the address to the uart before the SYN was
+  // completely received, then there is nothing left to withdraw
+  if ((miss || !mine) && withdraw()) {
+    DEBUG_LOG("ARB WITHDRAWN  0x%02x\n", _arbitrationAddress);
+    return withdrawn;
+  }
+  uint8_t send = sendArmed;
+  if (!_send.compare_exchange_strong(send, sendScheduled) &&
+      send == sendWithdrawn) {
+    DEBUG_LOG("ARB WITHDRAWN  0x%02x\n", _arbitrationAddress);
+    return withdrawn;
+  }
+
+  // the address is on the bus or about to be, follow it to won or lost
   _arbitrating = true;
   _participateSecond = false;
-  return started;
+  if (mine && !miss) {
+    DEBUG_LOG("ARB PREARMED   0x%02x %lu us\n", master,
+              busstate.microsSinceLastSyn());
+    return confirmed;
+  }
+  _prearmOrphans++;
+  DEBUG_LOG("ARB ORPHANED   0x%02x %lu us\n", _arbitrationAddress,
+            busstate.microsSinceLastSyn());
+  return orphaned;
+}
+
+bool Arbitration::withdraw() {
+  // Only the task that withdraws the armed address stops the timer, so a timer
+  // that already sent it or belongs to a confirmed arbitration is left alone.
+  // If the serial task schedules the next arbitration between the exchange and
+  // the cancel, that address is not sent and the arbitration is restarted like
+  // any address that got lost on the bus.
+  uint8_t send = sendArmed;
+  if (!_send.compare_exchange_strong(send, sendWithdrawn)) return false;
+  _clock->cancel();
+  return true;
 }
 
 Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
@@ -93,11 +295,15 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
       return error;
     case BusState::eReceivedAddressAfterFirstSYN:  // did we win 1st round of
                                                    // abitration?
+      _gap = startBitTime - _synStartBit;
+      // the start bit is that of our address also if another one wins
+      calibrate(startBitTime);
       if (symbol == _arbitrationAddress) {
         DEBUG_LOG("ARB WON1       0x%02x %lu us\n", symbol,
                   busstate.microsSinceLastSyn());
         _arbitrating = false;
         _restartCount = 0;
+        record(outcomeWon);
         return won1;  // we won; nobody else will write to the bus
       } else if ((symbol & 0b00001111) == (_arbitrationAddress & 0b00001111)) {
         DEBUG_LOG("ARB PART SECND 0x%02x 0x%02x\n", _arbitrationAddress,
@@ -117,23 +323,9 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
       if (_participateSecond && Bus.available() == 0) {
         // execute second round of arbitration
         uint32_t microsSinceLastSyn = busstate.microsSinceLastSyn();
-#if USE_ASYNCHRONOUS
-        // When in async mode, we get immediately interrupted when a symbol is
-        // received on the bus The earliest allowed to send is 4300 measured
-        // from the start bit of the SYN command. We receive the exact flange of
-        // the startbit, use that to calculate the exact time to wait. Then
-        // subtract time from the wait to allow the uart to put the byte on the
-        // bus. Testing has shown this requires about 700 micros on the
-        // esp32-c3.
-        uint32_t timeSinceStartBit = micros() - startBitTime;
-        int delay = 4300 - timeSinceStartBit - 700;
-        if (delay > 0) {
-          delayMicroseconds(delay);
-        }
-#endif
-        // Do logging of the ARB START message after writing the symbol, so
+        schedule(startBitTime);
+        // Do logging of the ARB START message after scheduling the symbol, so
         // enabled or disabled logging does not affect timing calculations.
-        Bus.write(_arbitrationAddress);
         DEBUG_LOG("ARB MASTER2    0x%02x %lu us\n", _arbitrationAddress,
                   microsSinceLastSyn);
       } else {
@@ -143,11 +335,14 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
       return arbitrating;
     case BusState::eReceivedAddressAfterSecondSYN:  // did we win 2nd round of
                                                     // arbitration?
+      _gap = startBitTime - _synStartBit;
+      calibrate(startBitTime);
       if (symbol == _arbitrationAddress) {
         DEBUG_LOG("ARB WON2       0x%02x %lu us\n", symbol,
                   busstate.microsSinceLastSyn());
         _arbitrating = false;
         _restartCount = 0;
+        record(outcomeWon);
         return won2;  // we won; nobody else will write to the bus
       } else {
         DEBUG_LOG("ARB LOST2      0x%02x %lu us\n", symbol,
@@ -161,6 +356,7 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
     case BusState::eBusy:
       _arbitrating = false;
       _restartCount = 0;
+      record(outcomeLost);
       return _participateSecond ? lost2 : lost1;
   }
   return arbitrating;
@@ -1,7 +1,5 @@
 #include "bus.hpp"
 
-#include <queue>
-
 // For ESP's based on FreeRTOS we can optimize the arbitration timing.
 // With SoftwareSerial we get notified with an callback that the
 // signal has changed. SoftwareSerial itself can and does know the
@@ -18,7 +16,6 @@ BusType Bus;
 
 // On ESP8266, maximum 512 icw SoftwareSerial, otherwise you run out of heap
 #define RXBUFFERSIZE 512
-#define QUEUE_SIZE 480
 
 #define BAUD_RATE 2400
 #define MAX_FRAMEBITS (1 + 8 + 1)
@@ -48,39 +45,128 @@ SemaphoreHandle_t getMutex() {
 #define ENH_MUTEX_UNLOCK()
 #endif
 
-WiFiClient* _arbitration_client = NULL;
-int _arbitration_address = -1;
+WiFiClient* _enhanced_clients = NULL;
+
+struct ArbitrationRequest {
+  WiFiClient* client;
+  uint8_t address;
+  uint32_t since;   // micros() of the CMD_START
+  uint8_t retries;  // lost arbitrations retried so far
+};
+
+ArbitrationRequest _arbitration_queue[ARBITRATION_QUEUE_SIZE];
+size_t _arbitration_queued = 0;
+ArbitrationWait _arbitration_waits[MAX_WIFI_CLIENTS];
+
+// Index of the request of the client or _arbitration_queued; call locked
+size_t findArbitrationRequest(const WiFiClient* client) {
+  size_t i = 0;
+  while (i < _arbitration_queued && _arbitration_queue[i].client != client) i++;
+  return i;
+}
+
+// Remove the request at index and return its wait time; call locked
+uint32_t removeArbitrationRequest(size_t index) {
+  uint32_t wait = micros() - _arbitration_queue[index].since;
+  for (size_t i = index + 1; i < _arbitration_queued; i++) {
+    _arbitration_queue[i - 1] = _arbitration_queue[i];
+  }
+  _arbitration_queued--;
+  return wait;
+}
+
+ArbitrationWait* arbitrationWait(const WiFiClient* client) {
+  uint8_t slot = clientSlot(client);
+  return slot < MAX_WIFI_CLIENTS ? &_arbitration_waits[slot] : NULL;
+}
 
 void getArbitrationClient(WiFiClient*& client, uint8_t& address) {
   ENH_MUTEX_LOCK();
-  client = _arbitration_client;
-  address = _arbitration_address;
+  if (_arbitration_queued > 0) {
+    client = _arbitration_queue[0].client;
+    address = _arbitration_queue[0].address;
+  } else {
+    client = NULL;
+  }
   ENH_MUTEX_UNLOCK();
 }
 
-void clearArbitrationClient() {
+void clearArbitrationClient(WiFiClient* client) {
   ENH_MUTEX_LOCK();
-  _arbitration_client = 0;
-  _arbitration_address = -1;
+  size_t i = findArbitrationRequest(client);
+  if (i < _arbitration_queued) {
+    removeArbitrationRequest(i);
+    ArbitrationWait* wait = arbitrationWait(client);
+    if (wait) wait->cancelled++;
+  }
   ENH_MUTEX_UNLOCK();
+  Bus.withdraw(client);
 }
 
 bool setArbitrationClient(WiFiClient*& client, uint8_t& address) {
   bool result = true;
   ENH_MUTEX_LOCK();
-  if (_arbitration_client == NULL) {
-    _arbitration_client = client;
-    _arbitration_address = address;
-  } else {
+  size_t i = findArbitrationRequest(client);
+  if (i < _arbitration_queued) {
+    // repeated request keeps its place
+    result = false;
+    _arbitration_queue[i].address = address;
+  } else if (_arbitration_queued == ARBITRATION_QUEUE_SIZE) {
     result = false;
-    client = _arbitration_client;
-    address = _arbitration_address;
+    client = _arbitration_queue[0].client;
+    address = _arbitration_queue[0].address;
+  } else {
+    _arbitration_queue[_arbitration_queued++] = {client, address, micros(), 0};
+    ArbitrationWait* wait = arbitrationWait(client);
+    if (wait) wait->requests++;
+  }
+  ENH_MUTEX_UNLOCK();
+  return result;
+}
+
+size_t arbitrationQueued() {
+  ENH_MUTEX_LOCK();
+  size_t queued = _arbitration_queued;
+  ENH_MUTEX_UNLOCK();
+  return queued;
+}
+
+void getArbitrationWaits(ArbitrationWait (&waits)[MAX_WIFI_CLIENTS]) {
+  ENH_MUTEX_LOCK();
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) waits[i] = _arbitration_waits[i];
+  ENH_MUTEX_UNLOCK();
+}
+
+bool arbitrationRetry(WiFiClient* client) {
+  bool result = false;
+  ENH_MUTEX_LOCK();
+  // the request stays at the head of the queue for the next SYN
+  if (_arbitration_queued > 0 && _arbitration_queue[0].client == client &&
+      _arbitration_queue[0].retries < ARBITRATION_RETRIES) {
+    _arbitration_queue[0].retries++;
+    result = true;
   }
   ENH_MUTEX_UNLOCK();
   return result;
 }
 
-void arbitrationDone() { clearArbitrationClient(); }
+uint8_t arbitrationDone(WiFiClient* client) {
+  uint8_t retries = 0;
+  ENH_MUTEX_LOCK();
+  // the client may have cancelled its request in the meantime
+  if (_arbitration_queued > 0 && _arbitration_queue[0].client == client) {
+    retries = _arbitration_queue[0].retries;
+    uint32_t time = removeArbitrationRequest(0);
+    ArbitrationWait* wait = arbitrationWait(client);
+    if (wait) {
+      wait->served++;
+      wait->totalWait += time;
+      if (time > wait->maxWait) wait->maxWait = time;
+    }
+  }
+  ENH_MUTEX_UNLOCK();
+  return retries;
+}
 
 WiFiClient* arbitrationRequested(uint8_t& address) {
   WiFiClient* client = NULL;
@@ -88,95 +174,150 @@ WiFiClient* arbitrationRequested(uint8_t& address) {
   return client;
 }
 
+void setEnhancedClients(WiFiClient* clients) { _enhanced_clients = clients; }
+
+uint8_t clientSlot(const WiFiClient* client) {
+  if (client == NULL || _enhanced_clients == NULL) return NO_CLIENT;
+  return client - _enhanced_clients;
+}
+
 BusType::BusType()
     : _nbrRestarts1(0),
       _nbrRestarts2(0),
       _nbrArbitrations(0),
       _nbrLost1(0),
       _nbrLost2(0),
+      _nbrRetries(0),
+      _nbrRetriesWon(0),
       _nbrWon1(0),
       _nbrWon2(0),
       _nbrErrors(0),
       _nbrLate(0),
-      _client(0) {}
+      _nbrOverflows(0),
+      _nbrCollisions(0),
+      _nbrEchoMissing(0),
+      _nbrEchoUntracked(0),
+      _maxQueued(0),
+      _readerCpuTime(0),
+      _readerLoad(0),
+      _client(0),
+      _prearmClient(0) {}
 
 BusType::~BusType() { end(); }
 
 #if USE_ASYNCHRONOUS
+// Notification bits of the serial task
+#define NOTIFY_START_BIT 0x01  // a new frame started on the bus
+#define NOTIFY_FRAME_END 0x02  // the current frame should be complete
+
+// Edges later than this after the start bit of a frame can only be the start
+// bit of the next frame. The last edge inside a frame is at 9 bit times, the
+// earliest next start bit at 10 bit times; half a bit margin on both sides
+// covers the baud rate tolerance of the other bus participants.
+#define FRAME_EDGES_MICROS ((2 * MAX_FRAMEBITS - 1) * 1000000 / 2 / BAUD_RATE)
+// Duration of a complete frame, after which SoftwareSerial can assemble it
+#define FRAME_MICROS (1 + MAX_FRAMEBITS * 1000000 / BAUD_RATE)
+#define BIT_MICROS (1000000 / BAUD_RATE)
+// How often to look again at bit intervals if a frame is not yet complete
+#define FRAME_RETRIES 4
+
 void IRAM_ATTR BusType::receiveHandler() {
+  // Only the start bit of a frame wakes up the serial task, all other edges
+  // are evaluated by SoftwareSerial when the frame is read
+  uint32_t now = micros();
+  uint32_t edgesEnd = Bus._frameEdgesEnd;
+  if (edgesEnd != 0 && static_cast<int32_t>(now - edgesEnd) < 0) return;
+  Bus._frameStart = now;
+  edgesEnd = now + FRAME_EDGES_MICROS;
+  Bus._frameEdgesEnd = edgesEnd != 0 ? edgesEnd : 1;
+
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-  vTaskNotifyGiveFromISR(Bus._serialEventTask, &xHigherPriorityTaskWoken);
+  xTaskNotifyFromISR(Bus._serialEventTask, NOTIFY_START_BIT, eSetBits,
+                     &xHigherPriorityTaskWoken);
   portEND_SWITCHING_ISR(xHigherPriorityTaskWoken);
 }
 
+void BusType::frameTimerHandler(void* args) {
+  // The edges of the frame are over, forget their end. Otherwise a start bit
+  // after the bus was idle for half the range of micros() would look like an
+  // edge within the frame. The exchange keeps the end of a frame whose start
+  // bit interrupted us.
+  uint32_t edgesEnd = Bus._frameEdgesEnd;
+  if (edgesEnd != 0 && static_cast<int32_t>(micros() - edgesEnd) >= 0)
+    Bus._frameEdgesEnd.compare_exchange_strong(edgesEnd, 0);
+  xTaskNotify(Bus._serialEventTask, NOTIFY_FRAME_END, eSetBits);
+}
+
+void BusType::armFrameTimer(uint32_t delay) {
+  esp_timer_stop(_frameTimer);
+  esp_timer_start_once(_frameTimer, delay > 0 ? delay : 1);
+}
+
+bool BusType::readFrames() {
+  // For SoftwareSerial;
+  // The method "available" always evaluates all the interrupts received
+  // The method "read" only evaluates the interrupts received if there is no
+  // byte available
+  bool received = false;
+  while (mySerial.available()) {
+    int symbol = mySerial.read();
+    receive(symbol, mySerial.readStartBitTimeStamp());
+    received = true;
+  }
+  return received;
+}
+
+void BusType::prearm(uint32_t startBitTime) {
+  if (!_busState.telegramComplete()) return;
+  uint8_t address;
+  WiFiClient* client = arbitrationRequested(address);
+  if (client == NULL) return;
+  // set before the timer is armed, so the client can withdraw right away
+  _prearmClient = client;
+  if (!_arbitration.prearm(_busState, address, startBitTime)) {
+    _prearmClient = NULL;
+  }
+}
+
 void BusType::readDataFromSoftwareSerial(void* args) {
+  // Instead of polling SoftwareSerial until a byte is complete, the start bit
+  // of each frame arms a timer for the expected end of that frame. Only then
+  // SoftwareSerial is asked for the byte, so the task sleeps while the frame
+  // is on the bus.
+  int retries = 0;
+  uint32_t windowStart = micros();
+  uint32_t windowBusy = 0;
+  uint32_t busyRemainder = 0;
   for (;;) {
-    BaseType_t r = ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
-    {
-      // For SoftwareSerial;
-      // The method "available" always evaluates all the interrupts received
-      // The method "read" only evaluates the interrupts received if there is no
-      // byte available
-      int avail = mySerial.available();
-      if (!avail && r == 1) {
-        // avoid this busy wait: delayMicroseconds(1+ MAX_FRAMEBITS * 1000000 /
-        // BAUD_RATE);
-
-        // Need to wait for 1000000 / BAUD_RATE, rounded to the next upper
-        // digit. delayMicroseconds is a busy wait, which blocks the CPU to do
-        // other things and could be the reason that the Wifi connection is
-        // blocked. Instead of a busy wait, do the majority of the waiting with
-        // vTaskDelay. Because vTaskDelay is switching at Tick cycle, doing
-        // vTaskDelay(1) can wait anywhere between 0 Tick and 1 Ticks. On esp32
-        // Arduino  1 Tick is 1 MilliSecond, although it depends on
-        // configuration.
-
-        // Validate 1 Tick is 1 MilliSecond with a compile time assert
-        static_assert(pdMS_TO_TICKS(1) == 1);
-        // static_assert(sizeof(uint32_t) == sizeof(unsigned long));
-
-        // We need to poll mySerial for availability of a byte. Testing has
-        // shown that from 1 millisecond onward we need to check for incoming
-        // data every 500 micros. We have to wait using vTaskDelay to allow the
-        // processor to do other things, however that only allows millisecond
-        // resolution. To work around, split the polling in two sections: 1)
-        // Wait for 500 micros using busy wait with delayMicroseconds 2) Wait
-        // the rest of the timeslice, which will be about 500 micros, using
-        // vTaskDelay
-        uint32_t begin = micros();
-        vTaskDelay(pdMS_TO_TICKS(1));
-        avail = mySerial.available();
-
-        // How was the delay until now?
-        uint32_t delayed = micros() - begin;
-
-        // Loop till the maximum duration of 1 byte (4167 micros from begin)
-        // and check every 500 micros, using combination of
-        // delayMicroseconds(500) and vTaskDelay(pdMS_TO_TICKS(1)) . The
-        // vTaskDelay will wait till the end of the current timeslice, which is
-        // typically about 500 micros away, because the previous vTaskDelay
-        // makes sure the code is already synced to this tick Assumption: time
-        // needed for mySerial.available() is less than 500 micros.
-        while (delayed < 4167 && !avail) {
-          if (4167 - delayed > 1000) {  // Need to wait more than 1000 micros?
-            delayMicroseconds(500);
-            avail = mySerial.available();
-            if (!avail) {
-              vTaskDelay(pdMS_TO_TICKS(1));
-            }
-          } else {  // Otherwise spend the remaining wait with delayMicroseconds
-            uint32_t delay = 4167 - delayed < 500 ? 4167 - delayed : 500;
-            delayMicroseconds(delay);
-          }
-          avail = mySerial.available();
-          delayed = micros() - begin;
-        }
-      }
-      if (avail) {
-        int symbol = mySerial.read();
-        Bus.receive(symbol, mySerial.readStartBitTimeStamp());
+    uint32_t notified = 0;
+    xTaskNotifyWait(0, ULONG_MAX, &notified, portMAX_DELAY);
+    uint32_t begin = micros();
+
+    if (notified & NOTIFY_START_BIT) {
+      // the previous frame is complete when the next one starts
+      Bus.readFrames();
+      Bus.prearm(Bus._frameStart);
+      retries = 0;
+      uint32_t elapsed = micros() - Bus._frameStart;
+      Bus.armFrameTimer(elapsed < FRAME_MICROS ? FRAME_MICROS - elapsed : 0);
+    } else if (notified & NOTIFY_FRAME_END) {
+      if (!Bus.readFrames() && retries++ < FRAME_RETRIES) {
+        Bus.armFrameTimer(BIT_MICROS / 2);
       }
     }
+
+    // cpu time spent by this task, the share is in per mille of the last
+    // second
+    uint32_t end = micros();
+    windowBusy += end - begin;
+    if (end - windowStart >= 1000000) {
+      Bus._readerLoad = uint64_t(windowBusy) * 1000 / (end - windowStart);
+      busyRemainder += windowBusy;
+      Bus._readerCpuTime += busyRemainder / 1000;
+      busyRemainder %= 1000;
+      windowBusy = 0;
+      windowStart = end;
+    }
   }
   vTaskDelete(NULL);
 }
@@ -197,7 +338,12 @@ void BusType::begin() {
 #endif
 
 #if USE_ASYNCHRONOUS
-  _queue = xQueueCreate(QUEUE_SIZE, sizeof(data));
+  esp_timer_create_args_t args = {};
+  args.callback = &BusType::frameTimerHandler;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "serialFrame";
+  esp_timer_create(&args, &_frameTimer);
+
   xTaskCreateUniversal(BusType::readDataFromSoftwareSerial, "_serialEventQueue",
                        SERIAL_EVENT_TASK_STACK_SIZE, this,
                        SERIAL_EVENT_TASK_PRIORITY, &_serialEventTask,
@@ -206,6 +352,14 @@ void BusType::begin() {
 #endif
 }
 
+int BusType::readerStackFree() const {
+#if USE_ASYNCHRONOUS
+  // the high water mark is in bytes on ESP-IDF, like the stack size
+  if (_serialEventTask) return uxTaskGetStackHighWaterMark(_serialEventTask);
+#endif
+  return 0;
+}
+
 void BusType::end() {
   BusSer.end();
 #if USE_SOFTWARE_SERIAL
@@ -213,11 +367,12 @@ void BusType::end() {
 #endif
 
 #if USE_ASYNCHRONOUS
-  vQueueDelete(_queue);
-  _queue = 0;
-
   vTaskDelete(_serialEventTask);
   _serialEventTask = 0;
+
+  esp_timer_stop(_frameTimer);
+  esp_timer_delete(_frameTimer);
+  _frameTimer = 0;
 #endif
 }
 
@@ -225,10 +380,52 @@ int BusType::availableForWrite() { return BusSer.availableForWrite(); }
 
 size_t BusType::write(uint8_t symbol) { return BusSer.write(symbol); }
 
+size_t BusType::write(const uint8_t* buffer, size_t size) {
+  return BusSer.write(buffer, size);
+}
+
+size_t BusType::send(uint8_t symbol, uint8_t slot) {
+  return send(&symbol, 1, slot);
+}
+
+size_t BusType::send(const uint8_t* buffer, size_t size, uint8_t slot) {
+  // the symbols already waiting in the uart go first
+  uint32_t now = micros();
+  uint32_t ahead = _echoes.size();
+  for (size_t i = 0; i < size; i++) {
+    uint32_t deadline = now + _arbitration.latency() +
+                        (ahead + i + 1) * BusState::SYMBOL_MICROS;
+    if (!_echoes.push({now, deadline, buffer[i], slot})) _nbrEchoUntracked++;
+  }
+  return write(buffer, size);
+}
+
+void BusType::verifyEcho(uint8_t symbol, uint32_t startBitTime) {
+  echo e;
+  while (_echoes.peek(e)) {
+    // a symbol that started before the write can not be its echo
+    if (static_cast<int32_t>(startBitTime - e._time) < 0) return;
+    _echoes.pop(e);
+    if (static_cast<int32_t>(startBitTime - e._deadline) > 0) {
+      _nbrEchoMissing++;
+      continue;
+    }
+    if (symbol != e._symbol) {
+      _nbrCollisions++;
+      DEBUG_LOG("BUS COLLISION  0x%02x 0x%02x\n", e._symbol, symbol);
+      if (e._client != NO_CLIENT) {
+        push({DATA_ENHANCED, ERROR_EBUS, ERR_FRAMING, e._client});
+      }
+      // the rest of the sent symbols can not be matched anymore
+      while (_echoes.pop(e)) {
+      }
+    }
+    return;
+  }
+}
+
 bool BusType::read(data& d) {
-#if USE_ASYNCHRONOUS
-  return xQueueReceive(_queue, &d, 0) == pdTRUE;
-#else
+#if !USE_ASYNCHRONOUS
 #if USE_SOFTWARE_SERIAL
   if (mySerial.available()) {
     uint8_t symbol = mySerial.read();
@@ -240,13 +437,8 @@ bool BusType::read(data& d) {
     receive(symbol, micros());
   }
 #endif
-  if (_queue.size() > 0) {
-    d = _queue.front();
-    _queue.pop();
-    return true;
-  }
-  return false;
 #endif
+  return _queue.pop(d);
 }
 
 int BusType::available() {
@@ -258,15 +450,26 @@ int BusType::available() {
 }
 
 void BusType::push(const data& d) {
-#if USE_ASYNCHRONOUS
-  xQueueSendToBack(_queue, &d, 0);
-#else
-  _queue.push(d);
-#endif
+  if (!_queue.push(d)) {
+    // data_process is not keeping up, the record is lost
+    _nbrOverflows++;
+    return;
+  }
+  int queued = _queue.size();
+  if (queued > _maxQueued) _maxQueued = queued;
+  if (_readCallback) _readCallback();
+}
+
+void BusType::setReadCallback(void (*callback)()) { _readCallback = callback; }
+
+void BusType::withdraw(const WiFiClient* client) {
+  if (client != NULL && _prearmClient == client) _arbitration.withdraw();
 }
 
 void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
-  _busState.data(symbol);
+  _busState.data(symbol, startBitTime);
+  verifyEcho(symbol, startBitTime);
+  uint8_t slot = clientSlot(_client);
   Arbitration::state state = _arbitration.data(_busState, symbol, startBitTime);
   switch (state) {
     case Arbitration::restart1:
@@ -278,8 +481,31 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
     case Arbitration::none:
     NONE:
       uint8_t address;
+      bool prearmed;
+      address = SYN;
       _client = arbitrationRequested(address);
-      if (_client) {
+      slot = clientSlot(_client);
+      prearmed = _arbitration.prearmed();
+      if (prearmed) {
+        WiFiClient* owner = _prearmClient.exchange(NULL);
+        switch (_arbitration.confirm(_busState, _client && _client == owner,
+                                     address, startBitTime)) {
+          case Arbitration::confirmed:
+            _nbrArbitrations++;
+            DEBUG_LOG("BUS START PREA 0x%02x %lu us\n", symbol,
+                      _busState.microsSinceLastSyn());
+            break;
+          case Arbitration::orphaned:
+            // the address is on the bus but nobody waits for the result
+            _client = NULL;
+            slot = NO_CLIENT;
+            break;
+          case Arbitration::withdrawn:
+            prearmed = false;
+            break;
+        }
+      }
+      if (_client && !prearmed) {
         switch (_arbitration.start(_busState, address, startBitTime)) {
           case Arbitration::started:
             _nbrArbitrations++;
@@ -294,13 +520,13 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
         }
       }
       // send to everybody. ebusd needs the SYN to get in the right mood
-      push({false, RECEIVED, symbol, 0, _client});
+      push({0, RECEIVED, symbol, slot});
       break;
     case Arbitration::arbitrating:
       DEBUG_LOG("BUS ARBITRATIN 0x%02x %lu us\n", symbol,
                 _busState.microsSinceLastSyn());
       // do not send to arbitration client
-      push({false, RECEIVED, symbol, _client, _client});
+      push({DATA_SKIP_CLIENT, RECEIVED, symbol, slot});
       break;
     case Arbitration::won1:
       _nbrWon1++;
@@ -308,13 +534,19 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
     case Arbitration::won2:
       _nbrWon2++;
     WON:
-      arbitrationDone();
+      if (_client == NULL) {
+        // an orphaned prearm won, free the bus again for everybody
+        write(SYN);
+        push({0, RECEIVED, symbol, slot});
+        break;
+      }
+      if (arbitrationDone(_client) > 0) _nbrRetriesWon++;
       DEBUG_LOG("BUS SEND WON   0x%02x %lu us\n", _busState._master,
                 _busState.microsSinceLastSyn());
       // send only to the arbitrating client
-      push({true, STARTED, _busState._master, _client, _client});
+      push({DATA_ENHANCED, STARTED, _busState._master, slot});
       // do not send to arbitrating client
-      push({false, RECEIVED, symbol, _client, _client});
+      push({DATA_SKIP_CLIENT, RECEIVED, symbol, slot});
       _client = 0;
       break;
     case Arbitration::lost1:
@@ -323,22 +555,32 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
     case Arbitration::lost2:
       _nbrLost2++;
     LOST:
-      arbitrationDone();
+      if (arbitrationRetry(_client)) {
+        _nbrRetries++;
+        DEBUG_LOG("BUS SEND RETRY 0x%02x 0x%02x %lu us\n", _busState._master,
+                  _busState._symbol, _busState.microsSinceLastSyn());
+        // the client is still waiting for its result; the winner's address
+        // goes to everybody
+        push({0, RECEIVED, symbol, slot});
+        _client = 0;
+        break;
+      }
+      arbitrationDone(_client);
       DEBUG_LOG("BUS SEND LOST  0x%02x 0x%02x %lu us\n", _busState._master,
                 _busState._symbol, _busState.microsSinceLastSyn());
       // send only to the arbitrating client
-      push({true, FAILED, _busState._master, _client, _client});
+      push({DATA_ENHANCED, FAILED, _busState._master, slot});
       // send to everybody
-      push({false, RECEIVED, symbol, 0, _client});
+      push({0, RECEIVED, symbol, slot});
       _client = 0;
       break;
     case Arbitration::error:
       _nbrErrors++;
-      arbitrationDone();
+      arbitrationDone(_client);
       // send only to the arbitrating client
-      push({true, ERROR_EBUS, ERR_FRAMING, _client, _client});
+      push({DATA_ENHANCED, ERROR_EBUS, ERR_FRAMING, slot});
       // send to everybody
-      push({false, RECEIVED, symbol, 0, _client});
+      push({0, RECEIVED, symbol, slot});
       _client = 0;
       break;
   }
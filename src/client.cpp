@@ -1,5 +1,7 @@
 #include "client.hpp"
 
+#include <lwip/sockets.h>
+
 #include "bus.hpp"
 #include "main.hpp"
 
@@ -33,19 +35,26 @@ bool handleNewClient(WiFiServer* server, WiFiClient clients[]) {
   return true;
 }
 
-void handleClient(WiFiClient* client) {
-  while (client->available() && Bus.availableForWrite() > 0) {
-    // working char by char is not very efficient
-    Bus.write(client->read());
-  }
+int sendClient(WiFiClient* client, const uint8_t* data, size_t len) {
+  int res = send(client->fd(), data, len, MSG_DONTWAIT);
+  if (res >= 0) return res;
+  return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
 }
 
-int pushClient(WiFiClient* client, uint8_t byte) {
-  if (client->availableForWrite() >= AVAILABLE_THRESHOLD) {
-    client->write(byte);
-    return 1;
+int handleClient(WiFiClient* client) {
+  uint8_t buffer[CLIENT_READ_SIZE];
+  int written = 0;
+  int avail, space;
+  while ((avail = client->available()) > 0 &&
+         (space = Bus.availableForWrite()) > 0) {
+    // hand over as much as the bus can take in one go
+    int len = avail < space ? avail : space;
+    if (len > CLIENT_READ_SIZE) len = CLIENT_READ_SIZE;
+    len = client->read(buffer, len);
+    if (len <= 0) break;
+    written += Bus.send(buffer, len, NO_CLIENT);
   }
-  return 0;
+  return written;
 }
 
 void decode(int b1, int b2, uint8_t (&data)[2]) {
@@ -71,7 +80,7 @@ void process_cmd(WiFiClient* client, uint8_t c, uint8_t d) {
   }
   if (c == CMD_START) {
     if (d == SYN) {
-      clearArbitrationClient();
+      clearArbitrationClient(client);
       DEBUG_LOG("CMD_START SYN\n");
       return;
     } else {
@@ -80,9 +89,10 @@ void process_cmd(WiFiClient* client, uint8_t c, uint8_t d) {
       uint8_t ad = d;
       if (!setArbitrationClient(client, d)) {
         if (cl != client) {
-          // only one client can be in arbitration
-          DEBUG_LOG("CMD_START ONGOING 0x%02 0x%02x\n", ad, d);
-          send_res(client, ERROR_HOST, ERR_FRAMING);
+          // all places in the arbitration queue are taken, client and d now
+          // name the head of the queue
+          DEBUG_LOG("CMD_START ONGOING 0x%02x 0x%02x\n", ad, d);
+          send_res(cl, ERROR_HOST, ERR_FRAMING);
           return;
         } else {
           DEBUG_LOG("CMD_START REPEAT 0x%02x\n", d);
@@ -90,13 +100,12 @@ void process_cmd(WiFiClient* client, uint8_t c, uint8_t d) {
       } else {
         DEBUG_LOG("CMD_START 0x%02x\n", d);
       }
-      setArbitrationClient(client, d);
       return;
     }
   }
   if (c == CMD_SEND) {
     DEBUG_LOG("SEND 0x%02x\n", d);
-    Bus.write(d);
+    Bus.send(d, clientSlot(client));
     return;
   }
   if (c == CMD_INFO) {
@@ -105,20 +114,19 @@ void process_cmd(WiFiClient* client, uint8_t c, uint8_t d) {
   }
 }
 
-bool read_cmd(WiFiClient* client, uint8_t (&data)[2]) {
+// Decode one command from the bytes read from the client. Returns the number
+// of bytes used from the buffer, 0 on a protocol error.
+size_t read_cmd(WiFiClient* client, const uint8_t* buffer, size_t len,
+                uint8_t (&data)[2]) {
   int b, b2;
+  size_t used = 1;
 
-  b = client->read();
-
-  if (b < 0) {
-    // available and read -1 ???
-    return false;
-  }
+  b = buffer[0];
 
   if (b < 0b10000000) {
     data[0] = CMD_SEND;
     data[1] = b;
-    return true;
+    return used;
   }
 
   if (b < 0b11000000) {
@@ -126,17 +134,23 @@ bool read_cmd(WiFiClient* client, uint8_t (&data)[2]) {
     client->write("first command signature error");
     // first command signature error
     client->stop();
-    return false;
+    return 0;
   }
 
-  b2 = client->read();
+  if (len > 1) {
+    b2 = buffer[1];
+    used++;
+  } else {
+    // the second byte did not fit in the read buffer
+    b2 = client->read();
+  }
 
   if (b2 < 0) {
     // second command missing
     DEBUG_LOG("second command missing\n");
     client->write("second command missing");
     client->stop();
-    return false;
+    return 0;
   }
 
   if ((b2 & 0b11000000) != 0b10000000) {
@@ -144,36 +158,117 @@ bool read_cmd(WiFiClient* client, uint8_t (&data)[2]) {
     DEBUG_LOG("second command signature error\n");
     client->write("second command signature error");
     client->stop();
-    return false;
+    return 0;
   }
 
   decode(b, b2, data);
-  return true;
+  return used;
 }
 
 void handleClientEnhanced(WiFiClient* client) {
-  while (client->available()) {
-    uint8_t data[2];
-    if (read_cmd(client, data)) {
+  uint8_t buffer[CLIENT_READ_SIZE];
+  int avail;
+  while ((avail = client->available()) > 0) {
+    int len = client->read(buffer, avail < CLIENT_READ_SIZE ? avail
+                                                            : CLIENT_READ_SIZE);
+    if (len <= 0) {
+      // available and read -1 ???
+      return;
+    }
+    for (size_t pos = 0; pos < size_t(len);) {
+      uint8_t data[2];
+      size_t used = read_cmd(client, buffer + pos, len - pos, data);
+      if (used == 0) return;
       process_cmd(client, data[0], data[1]);
+      pos += used;
     }
   }
 }
 
-int pushClientEnhanced(WiFiClient* client, uint8_t c, uint8_t d, bool log) {
-  if (log) {
-    DEBUG_LOG("DATA           0x%02x 0x%02x\n", c, d);
+#if !defined(EBUS_INTERNAL)
+bool drainDue(const ClientRing& ring, const ClientCursor& cursor,
+              uint32_t now) {
+  if (cursor.urgent || cursor.overrun || cursor.restLen > 0) return true;
+  size_t pending = ring.pending(cursor);
+  return pending > 0 && (pending >= CLIENT_DRAIN_RECORDS ||
+                         now - ring.oldest(cursor) >= CLIENT_FLUSH_MICROS);
+}
+
+template <typename Encode>
+int drain(WiFiClient* client, const ClientRing& ring, ClientCursor& cursor,
+          PortStatistics& statistics, const uint8_t* marker, size_t markerLen,
+          Encode encode) {
+  if (!*client) {
+    // new clients start with the next record
+    ring.reset(cursor);
+    return 0;
   }
-  if (client->availableForWrite() >= AVAILABLE_THRESHOLD) {
-    send_res(client, c, d);
-    return 1;
+
+  uint32_t dropped = cursor.dropped;
+  int taken = ring.drain(cursor, marker, markerLen, encode,
+                         [client](const uint8_t* data, size_t len) {
+                           return sendClient(client, data, len);
+                         });
+  statistics.dropped += cursor.dropped - dropped;
+
+  if (taken < 0) {
+    client->stop();
+    ring.reset(cursor);
+    return 0;
   }
-  return 0;
+  if (taken > 0) {
+    statistics.packets++;
+    statistics.bytes += taken;
+  }
+  return taken;
 }
 
+int drainClient(WiFiClient* client, const ClientRing& ring,
+                ClientCursor& cursor, PortStatistics& statistics) {
+  // a lagging client continues at the next SYN
+  const uint8_t marker[] = {SYN};
+  return drain(client, ring, cursor, statistics, marker, sizeof(marker),
+               [](const BusType::data& d, uint8_t* out) -> size_t {
+                 if (d._flags & BusType::DATA_ENHANCED) return 0;
+                 out[0] = d._d;
+                 return 1;
+               });
+}
+
+int drainClientEnhanced(WiFiClient* client, const ClientRing& ring,
+                        ClientCursor& cursor, PortStatistics& statistics,
+                        uint8_t slot) {
+  uint8_t marker[2];
+  encode(ERROR_HOST, ERR_OVERRUN, marker);
+  return drain(client, ring, cursor, statistics, marker, sizeof(marker),
+               [slot](const BusType::data& d, uint8_t* out) -> size_t {
+                 uint8_t data[2];
+                 if (d._flags & BusType::DATA_ENHANCED) {
+                   // only the arbitrating client gets the enhanced responses
+                   if (d._client != slot) return 0;
+                   DEBUG_LOG("DATA           0x%02x 0x%02x\n", d._c, d._d);
+                   encode(d._c, d._d, data);
+                 } else {
+                   if ((d._flags & BusType::DATA_SKIP_CLIENT) &&
+                       d._client == slot)
+                     return 0;
+                   encode(RECEIVED, d._d, data);
+                 }
+                 out[0] = data[0];
+                 out[1] = data[1];
+                 return 2;
+               });
+}
+#endif
+
 #if defined(EBUS_INTERNAL)
+#include <ArduinoJson.h>
+
 #include <algorithm>
 
+#include "arbiter.hpp"
+#include "multicast.hpp"
+
 AbstractClient::AbstractClient(WiFiClient* client, ebus::Request* request,
                                bool write)
     : client(client), request(request), write(write) {}
@@ -188,6 +283,95 @@ void AbstractClient::stop() {
   if (client) client->stop();
 }
 
+uint32_t AbstractClient::drain(const ClientByteRing& ring,
+                               ClientLatency& latency) {
+  if (!isConnected() || !flush()) return 0;
+  if (!ring.unread(cursor)) return 0;
+
+  uint32_t dropped = cursor.dropped;
+  bool records = ring.pending(cursor) > 0;
+  uint32_t oldest = ring.oldest(cursor);
+
+  uint8_t marker[BROADCAST_RECORD_MAX];
+  size_t markerLen = encodeOverrun(marker);
+  int taken = ring.drain(
+      cursor, marker, markerLen,
+      [this](const ClientByte& record, uint8_t* out) -> size_t {
+        return record.skip == this ? 0 : encodeByte(record.byte, out);
+      },
+      [this](const uint8_t* data, size_t len) {
+        return sendClient(client, data, len);
+      });
+  if (taken < 0) stop();
+  if (taken > 0 && records) latency.add(micros() - oldest);
+  return cursor.dropped - dropped;
+}
+
+void AbstractClient::resetCursor(const ClientByteRing& ring) {
+  ring.reset(cursor);
+}
+
+bool AbstractClient::behind(const ClientByteRing& ring) const {
+  return backlogLen > 0 || ring.unread(cursor);
+}
+
+bool AbstractClient::writeFrame(const TelegramFrame& frame) { return false; }
+
+bool AbstractClient::readFilter() { return false; }
+
+uint32_t AbstractClient::dropped() const { return cursor.dropped; }
+
+size_t AbstractClient::backlog() const { return backlogLen; }
+
+size_t AbstractClient::backlogMax() const { return backlogPeak; }
+
+bool AbstractClient::overflowed() const { return backlogOverflow; }
+
+bool AbstractClient::send(const uint8_t* data, size_t len) {
+  if (!isConnected()) return false;
+  if (backlogLen + len > sizeof(backlogBuffer)) {
+    // the client would miss protocol responses, better it reconnects
+    backlogOverflow = true;
+    stop();
+    return false;
+  }
+  memcpy(backlogBuffer + backlogLen, data, len);
+  backlogLen += len;
+  if (backlogLen > backlogPeak) backlogPeak = backlogLen;
+  return true;
+}
+
+size_t AbstractClient::backlogFree() const {
+  return sizeof(backlogBuffer) - backlogLen;
+}
+
+bool AbstractClient::flush() {
+  if (backlogLen == 0) return true;
+  int taken = sendClient(client, backlogBuffer, backlogLen);
+  if (taken < 0) {
+    stop();
+    return false;
+  }
+  backlogLen -= taken;
+  memmove(backlogBuffer, backlogBuffer + taken, backlogLen);
+  return backlogLen == 0;
+}
+
+void AbstractClient::watch(SocketWaiter& waiter) const {
+  if (client) waiter.add(client);
+}
+
+size_t AbstractClient::encodeByte(uint8_t byte, uint8_t* out) const {
+  out[0] = byte;
+  return 1;
+}
+
+size_t AbstractClient::encodeOverrun(uint8_t* out) const {
+  // a lagging client continues at the next SYN
+  out[0] = SYN;
+  return 1;
+}
+
 ReadOnlyClient::ReadOnlyClient(WiFiClient* client, ebus::Request* request)
     : AbstractClient(client, request, false) {}
 
@@ -195,15 +379,77 @@ bool ReadOnlyClient::available() const { return false; }
 
 bool ReadOnlyClient::readByte(uint8_t& byte) { return false; }
 
-bool ReadOnlyClient::writeBytes(const std::vector<uint8_t>& bytes) {
-  if (!isConnected() || bytes.empty()) return false;
+bool ReadOnlyClient::writeBytes(const uint8_t* bytes, size_t len) {
+  if (len == 0) return false;
 
-  client->write(bytes.data(), bytes.size());
-  return true;
+  return send(bytes, len);
 }
 
 bool ReadOnlyClient::handleBusData(const uint8_t& byte) { return false; }
 
+const char* ReadOnlyClient::type() const { return "ReadOnly"; }
+
+bool ReadOnlyClient::readFilter() {
+  bool changed = false;
+  while (client && client->available() > 0) {
+    char c = client->read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      // an overlong line is no spec, it is dropped at its end
+      if (lineLen < sizeof(line)) line[lineLen] = c;
+      lineLen++;
+      continue;
+    }
+    if (lineLen > 0 && lineLen < sizeof(line)) {
+      line[lineLen] = '\0';
+      FilterSpec spec;
+      if (spec.parse(line)) {
+        filter.spec = spec;
+        filter.active = true;
+        changed = true;
+      }
+    }
+    lineLen = 0;
+  }
+  return changed;
+}
+
+size_t ReadOnlyClient::encodeByte(uint8_t byte, uint8_t* out) const {
+  return filter.active ? 0 : AbstractClient::encodeByte(byte, out);
+}
+
+TelegramClient::TelegramClient(WiFiClient* client, ebus::Request* request)
+    : AbstractClient(client, request, false) {}
+
+bool TelegramClient::available() const { return false; }
+
+bool TelegramClient::readByte(uint8_t& byte) { return false; }
+
+bool TelegramClient::writeBytes(const uint8_t* bytes, size_t len) {
+  return false;
+}
+
+bool TelegramClient::handleBusData(const uint8_t& byte) { return false; }
+
+const char* TelegramClient::type() const { return "Telegram"; }
+
+bool TelegramClient::writeFrame(const TelegramFrame& frame) {
+  if (!isConnected()) return false;
+  if (frame.len > backlogFree()) {
+    frameDrops++;
+    return false;
+  }
+  return send(frame.data, frame.len);
+}
+
+uint32_t TelegramClient::dropped() const { return frameDrops; }
+
+size_t TelegramClient::encodeByte(uint8_t byte, uint8_t* out) const {
+  return 0;
+}
+
+size_t TelegramClient::encodeOverrun(uint8_t* out) const { return 0; }
+
 RegularClient::RegularClient(WiFiClient* client, ebus::Request* request)
     : AbstractClient(client, request, true) {}
 
@@ -217,11 +463,10 @@ bool RegularClient::readByte(uint8_t& byte) {
   return false;
 }
 
-bool RegularClient::writeBytes(const std::vector<uint8_t>& bytes) {
-  if (!isConnected() || bytes.empty()) return false;
+bool RegularClient::writeBytes(const uint8_t* bytes, size_t len) {
+  if (len == 0) return false;
 
-  client->write(bytes.data(), bytes.size());
-  return true;
+  return send(bytes, len);
 }
 
 bool RegularClient::handleBusData(const uint8_t& byte) {
@@ -240,7 +485,7 @@ bool RegularClient::handleBusData(const uint8_t& byte) {
     case ebus::RequestResult::retrySyn:
     case ebus::RequestResult::firstWon:
     case ebus::RequestResult::secondWon:
-      writeBytes({byte});
+      writeBytes(&byte, 1);
       return true;
     default:
       break;
@@ -248,6 +493,8 @@ bool RegularClient::handleBusData(const uint8_t& byte) {
   return false;
 }
 
+const char* RegularClient::type() const { return "Regular"; }
+
 EnhancedClient::EnhancedClient(WiFiClient* client, ebus::Request* request)
     : AbstractClient(client, request, true) {}
 
@@ -271,7 +518,8 @@ bool EnhancedClient::readByte(uint8_t& byte) {
   // Check signatures
   if ((b1 & 0xc0) != 0xc0 || (b2 & 0xc0) != 0x80) {
     // Invalid signature, protocol error
-    writeBytes({ERROR_HOST, ERR_FRAMING});
+    writeCommand(ERROR_HOST, ERR_FRAMING);
+    flush();
     client->stop();
     return false;
   }
@@ -283,7 +531,7 @@ bool EnhancedClient::readByte(uint8_t& byte) {
   // Handle commands
   switch (cmd) {
     case CMD_INIT:
-      writeBytes({RESETTED, 0x0});
+      writeCommand(RESETTED, 0x0);
       return false;
     case CMD_SEND:
       byte = data;
@@ -301,27 +549,44 @@ bool EnhancedClient::readByte(uint8_t& byte) {
   return false;
 }
 
-bool EnhancedClient::writeBytes(const std::vector<uint8_t>& bytes) {
-  if (!isConnected() || bytes.empty()) return false;
-
-  uint8_t cmd = RECEIVED;
-  uint8_t data = bytes[0];
+bool EnhancedClient::writeBytes(const uint8_t* bytes, size_t len) {
+  if (len == 0) return false;
 
-  if (bytes.size() == 2) {
-    cmd = bytes[0];
-    data = bytes[1];
+  // Stage the encoded bytes, so the backlog takes one chunk at a time
+  uint8_t out[BROADCAST_CHUNK];
+  size_t used = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (used + BROADCAST_RECORD_MAX > sizeof(out)) {
+      if (!send(out, used)) return false;
+      used = 0;
+    }
+    used += encodeByte(bytes[i], out + used);
   }
+  return send(out, used);
+}
+
+bool EnhancedClient::writeCommand(uint8_t cmd, uint8_t data) {
+  uint8_t out[2];
+  out[0] = 0xc0 | (cmd << 2) | (data >> 6);
+  out[1] = 0x80 | (data & 0x3f);
+  return send(out, 2);
+}
 
+size_t EnhancedClient::encodeByte(uint8_t byte, uint8_t* out) const {
   // Short form for data < 0x80
-  if (bytes.size() == 1 && data < 0x80) {
-    client->write(data);
-  } else {
-    uint8_t out[2];
-    out[0] = 0xc0 | (cmd << 2) | (data >> 6);
-    out[1] = 0x80 | (data & 0x3f);
-    client->write(out, 2);
+  if (byte < 0x80) {
+    out[0] = byte;
+    return 1;
   }
-  return true;
+  out[0] = 0xc0 | (RECEIVED << 2) | (byte >> 6);
+  out[1] = 0x80 | (byte & 0x3f);
+  return 2;
+}
+
+size_t EnhancedClient::encodeOverrun(uint8_t* out) const {
+  out[0] = 0xc0 | (ERROR_HOST << 2) | (ERR_OVERRUN >> 6);
+  out[1] = 0x80 | (ERR_OVERRUN & 0x3f);
+  return 2;
 }
 
 bool EnhancedClient::handleBusData(const uint8_t& byte) {
@@ -330,15 +595,15 @@ bool EnhancedClient::handleBusData(const uint8_t& byte) {
     case ebus::RequestResult::observeSyn:
     case ebus::RequestResult::firstLost:
     case ebus::RequestResult::secondLost:
-      writeBytes({FAILED, byte});
+      writeCommand(FAILED, byte);
       return false;
     case ebus::RequestResult::firstError:
     case ebus::RequestResult::retryError:
     case ebus::RequestResult::secondError:
-      writeBytes({ERROR_EBUS, ERR_FRAMING});
+      writeCommand(ERROR_EBUS, ERR_FRAMING);
       return false;
     case ebus::RequestResult::observeData:
-      writeBytes({RECEIVED, byte});
+      writeCommand(RECEIVED, byte);
       return true;
     case ebus::RequestResult::firstSyn:
     case ebus::RequestResult::firstRetry:
@@ -347,7 +612,7 @@ bool EnhancedClient::handleBusData(const uint8_t& byte) {
       return true;
     case ebus::RequestResult::firstWon:
     case ebus::RequestResult::secondWon:
-      writeBytes({STARTED, byte});
+      writeCommand(STARTED, byte);
       return true;
     default:
       break;
@@ -355,96 +620,305 @@ bool EnhancedClient::handleBusData(const uint8_t& byte) {
   return false;
 }
 
+const char* EnhancedClient::type() const { return "Enhanced"; }
+
+void encodeTelegram(TelegramFrame& frame, uint32_t time, uint8_t messageType,
+                    uint8_t telegramType, uint8_t status,
+                    const std::vector<uint8_t>& master,
+                    const std::vector<uint8_t>& slave) {
+  uint8_t* out = frame.data + 2;
+  for (int i = 0; i < 4; i++) *out++ = time >> (8 * i);
+  *out++ = messageType;
+  *out++ = telegramType;
+  *out++ = status;
+  for (const std::vector<uint8_t>* part : {&master, &slave}) {
+    size_t len = std::min<size_t>(part->size(), TELEGRAM_FRAME_BYTES);
+    *out++ = len;
+    std::copy(part->begin(), part->begin() + len, out);
+    out += len;
+  }
+  frame.len = out - frame.data;
+  frame.data[0] = (frame.len - 2) & 0xff;
+  frame.data[1] = (frame.len - 2) >> 8;
+}
+
 ClientManager clientManager;
 
 ClientManager::ClientManager()
-    : readonlyServer(3334), regularServer(3333), enhancedServer(3335) {}
+    : readonlyServer(3334),
+      regularServer(3333),
+      enhancedServer(3335),
+      telegramServer(CLIENT_TELEGRAM_PORT) {}
 
 void ClientManager::start(ebus::Bus* bus, ebus::Request* request,
                           ebus::ServiceRunnerFreeRtos* serviceRunner) {
   readonlyServer.begin();
   regularServer.begin();
   enhancedServer.begin();
+  telegramServer.begin();
 
   this->request = request;
   this->serviceRunner = serviceRunner;
 
-  clientByteQueue = new ebus::Queue<uint8_t>();
+  clientByteQueue = new ebus::Queue<TimedByte>();
+  clientsMutex = xSemaphoreCreateMutex();
+  waiter.begin();
+
+  request->setExternalBusRequestedCallback([this]() {
+    busRequested = true;
+    waiter.signal();
+  });
 
-  request->setExternalBusRequestedCallback([this]() { busRequested = true; });
+  arbiter.setWakeup(BusSource::client, &ClientManager::arbiterReleased);
 
-  serviceRunner->addByteListener(
-      [this](const uint8_t& byte) { clientByteQueue->try_push(byte); });
+  serviceRunner->addByteListener([this](const uint8_t& byte) {
+    uint32_t time = micros();
+    onBusByte(byte, time);
+    clientByteQueue->try_push({byte, time});
+    busBytes = true;
+    waiter.signal();
+  });
 
   // Start the clientManagerRunner task
   xTaskCreate(&ClientManager::taskFunc, "clientManagerRunner", 4096, this, 3,
               &clientManagerTaskHandle);
 }
 
-void ClientManager::stop() { stopRunner = true; }
+void ClientManager::stop() {
+  stopRunner = true;
+  waiter.signal();
+}
+
+uint32_t ClientManager::dropped() const { return droppedBytes; }
+
+const ClientLatency& ClientManager::latency() const { return byteLatency; }
+
+const TransmitGaps& ClientManager::transmitGaps() const { return gaps; }
+
+void ClientManager::onBusByte(uint8_t byte, uint32_t time) {
+  if (!transmitArmed) return;
+  uint32_t last = lastByteTime.exchange(time);
+  if (last != 0) gaps.add(time - last);
+
+  // the bus is ours, so this is the echo of the byte written last
+  uint8_t echo = transmitEcho;
+  transmitState.compare_exchange_strong(echo, transmitIdle);
+
+  if (byte == SYN) {
+    // the bus is free again, the transaction is over
+    transmitArmed = false;
+    lastByteTime = 0;
+    return;
+  }
+  continueTransmit();
+}
+
+void ClientManager::continueTransmit() {
+  for (;;) {
+    uint8_t idle = transmitIdle;
+    if (!transmitState.compare_exchange_strong(idle, transmitWriting)) return;
+    uint8_t byte;
+    if (transmitArmed && transmitQueue.pop(byte)) {
+      ebus::bus->writeByte(byte);
+      transmitState = transmitEcho;
+      // endTransmit waits for the queue
+      if (!transmitArmed) waiter.signal();
+      return;
+    }
+    transmitState = transmitIdle;
+    if (!transmitArmed) {
+      waiter.signal();
+      return;
+    }
+    // retry if the task queued a byte while we were writing
+    if (transmitQueue.empty()) return;
+  }
+}
+
+void ClientManager::endTransmit() {
+  transmitArmed = false;
+  // take over the queue, the listener holds it only while writing
+  for (;;) {
+    uint8_t state = transmitIdle;
+    if (transmitState.compare_exchange_strong(state, transmitWriting)) break;
+    if (state == transmitEcho &&
+        transmitState.compare_exchange_strong(state, transmitWriting))
+      break;
+    // the listener is writing and signals once it let go of the queue, it
+    // sees transmitArmed cleared because both are sequentially consistent
+    waiter.clear();
+    waiter.wait(CLIENT_RETRY_MICROS, &ClientManager::transmitReleased);
+  }
+  uint8_t byte;
+  while (transmitQueue.pop(byte)) {
+  }
+  transmitState = transmitIdle;
+}
+
+bool ClientManager::busBytesQueued() {
+  return clientManager.busBytes || clientManager.busReleased ||
+         !clientManager.telegramQueue.empty();
+}
+
+void ClientManager::arbiterReleased() {
+  clientManager.busReleased = true;
+  clientManager.waiter.signal();
+}
+
+bool ClientManager::transmitReleased() {
+  return clientManager.transmitState != transmitWriting;
+}
+
+void ClientManager::updateFilters() {
+  for (size_t i = 0; i < clients.size(); ++i) {
+    if (clients[i]->readFilter()) filtersChanged = true;
+  }
+  if (!filtersChanged) return;
+  filtersChanged = false;
+
+  filterTable.clear();
+  uint8_t slot = 0;
+  for (size_t i = 0; i < clients.size(); ++i) {
+    ClientFilter& filter = clients[i]->filter;
+    if (!filter.active) continue;
+    if (slot == FILTER_SLOTS) {
+      // no bit left, the client gets everything
+      filter.active = false;
+      continue;
+    }
+    filter.slot = slot++;
+    filterTable.add(filter.slot, filter.spec);
+  }
+}
+
+void ClientManager::filterByte(uint8_t byte) {
+  if (byte != SYN) {
+    // the last byte is kept for the SYN
+    if (filterLen < sizeof(filterBuffer) - 1)
+      filterBuffer[filterLen++] = byte;
+    else
+      filterOverflow = true;
+    return;
+  }
+
+  if (filterOverflow) {
+    // only a part of the telegram is known, nobody gets it and it is not
+    // counted as saved by the filters
+    filterOverflows++;
+    filterLen = 0;
+    filterOverflow = false;
+    return;
+  }
+
+  // QQ ZZ PB SB of the telegram, PB and SB may be escaped
+  uint8_t header[4];
+  size_t headerLen = 0;
+  for (size_t i = 0; i < filterLen && headerLen < 4; i++) {
+    uint8_t value = filterBuffer[i];
+    if (value == ESC && i + 1 < filterLen)
+      value = filterBuffer[++i] == 0x00 ? ESC : SYN;
+    header[headerLen++] = value;
+  }
+
+  // matched once for all clients, incomplete telegrams match nobody
+  uint32_t slots = 0;
+  if (headerLen == 4)
+    slots = filterTable.match(header[0], header[1], header[2], header[3]);
+
+  filterBuffer[filterLen++] = SYN;
+  for (size_t i = 0; i < clients.size(); ++i) {
+    ClientFilter& filter = clients[i]->filter;
+    if (!filter.active) continue;
+    if (!(slots & (1UL << filter.slot)))
+      filter.saved += filterLen;
+    else if (clients[i]->writeBytes(filterBuffer, filterLen))
+      filter.forwarded += filterLen;
+  }
+  filterLen = 0;
+}
+
+void ClientManager::pushTelegram(TelegramFrame& frame) {
+  frame.sequence = telegramSequence++;
+  if (!telegramQueue.push(frame)) telegramOverflows++;
+  waiter.signal();
+}
+
+uint32_t ClientManager::waitTimeout() const {
+  for (size_t i = 0; i < clients.size(); ++i) {
+    if (clients[i]->behind(clientRing)) return CLIENT_RETRY_MICROS;
+  }
+  return CLIENT_WAIT_MICROS;
+}
 
 void ClientManager::taskFunc(void* arg) {
   ClientManager* self = static_cast<ClientManager*>(arg);
   AbstractClient* activeClient = nullptr;
   BusState busState = BusState::Idle;
-  uint8_t receiveByte = 0;
+  TimedByte receiveByte;
 
   for (;;) {
     if (self->stopRunner) vTaskDelete(NULL);
 
-    // Check for new clients
-    self->acceptClients();
-
-    // Clean up disconnected active client
+    // Clean up disconnected active client, before it is deleted
     if (activeClient && !activeClient->isConnected()) {
       activeClient->stop();
       activeClient = nullptr;
       busState = BusState::Idle;
       self->busRequested = false;
+      self->endTransmit();
+      arbiter.release(BusSource::client);
       ebus::request->reset();
     }
 
+    // Check for new clients
+    self->acceptClients();
+    self->updateFilters();
+
     // Select new active client if idle
     if (!activeClient && busState == BusState::Idle) {
-      for (size_t i = 0; i < self->clients.size(); ++i) {
-        AbstractClient* client = self->clients[i].get();
-        if (client->isConnected() && client->isWriteCapable() &&
-            client->available()) {
-          activeClient = client;
-          busState = BusState::Request;
-          self->busRequested = false;
-          break;
-        }
+      activeClient = self->selectClient();
+      if (activeClient) {
+        busState = BusState::Request;
+        self->busRequested = false;
       }
     }
 
-    // Request bus access
+    // Request bus access, shared with the schedule through the arbiter
     if (activeClient && busState == BusState::Request) {
-      if (ebus::request->busAvailable()) {
+      self->busReleased = false;
+      if (arbiter.acquire(BusSource::client) &&
+          ebus::request->busAvailable()) {
         uint8_t firstByte = 0;
         if (activeClient->readByte(firstByte)) {
           ebus::request->requestBus(firstByte, true);
+          activeClient->access.bytes++;
           busState = BusState::Response;
         } else {
           // Client initialized or error
           activeClient = nullptr;
           busState = BusState::Idle;
           self->busRequested = false;
+          self->endTransmit();
+          arbiter.release(BusSource::client);
           ebus::request->reset();
         }
       }
     }
 
-    // Transmit to bus if needed
+    // Buffer what the client sent ahead, the byte listener writes it to the
+    // bus right after the echo of the previous byte
     if (activeClient && busState == BusState::Transmit) {
       uint8_t sendByte = 0;
-      if (activeClient->readByte(sendByte)) {
-        ebus::bus->writeByte(sendByte);
-        busState = BusState::Response;
+      while (self->transmitQueue.size() < self->transmitQueue.capacity() &&
+             activeClient->readByte(sendByte)) {
+        self->transmitQueue.push(sendByte);
+        activeClient->access.bytes++;
       }
+      self->continueTransmit();
     }
 
     // Process received bytes from bus
+    self->busBytes = false;
     while (self->clientByteQueue->try_pop(receiveByte)) {
       updateLastComms();
 
@@ -452,38 +926,138 @@ void ClientManager::taskFunc(void* arg) {
         if ((busState == BusState::Response ||
              busState == BusState::Transmit) &&
             self->busRequested) {
-          if (activeClient->handleBusData(receiveByte)) {
+          // keep the order of the bytes already in the ring
+          self->droppedBytes +=
+              activeClient->drain(self->clientRing, self->byteLatency);
+          if (activeClient->handleBusData(receiveByte.byte)) {
             // Continue transmitting if needed
             busState = BusState::Transmit;
+            ebus::RequestResult result = ebus::request->getResult();
+            if (!self->transmitArmed &&
+                (result == ebus::RequestResult::firstWon ||
+                 result == ebus::RequestResult::secondWon)) {
+              self->lastByteTime = 0;
+              self->transmitArmed = true;
+            }
           } else {
             // Transaction done or error
             activeClient = nullptr;
             busState = BusState::Idle;
             self->busRequested = false;
+            self->endTransmit();
+            arbiter.release(BusSource::client);
             ebus::request->reset();
           }
         }
       }
 
       // Forward to all other clients
+      self->clientRing.push({receiveByte.byte, activeClient},
+                            receiveByte.time);
+      self->filterByte(receiveByte.byte);
+    }
+
+    // Telegram frames go to the backlogs of the telegram clients and once
+    // to the multicast group
+    TelegramFrame frame;
+    while (self->telegramQueue.pop(frame)) {
+      multicast.send(frame);
       for (size_t i = 0; i < self->clients.size(); ++i) {
-        AbstractClient* client = self->clients[i].get();
-        if (client != activeClient && client->isConnected()) {
-          client->writeBytes({receiveByte});
-        }
+        self->clients[i]->writeFrame(frame);
+      }
+    }
+
+    // Each client drains the ring at its own pace
+    for (size_t i = 0; i < self->clients.size(); ++i) {
+      self->droppedBytes +=
+          self->clients[i]->drain(self->clientRing, self->byteLatency);
+    }
+
+    // Sleep until there is something to do. Only the sockets whose data is
+    // read next are watched, others would keep select from sleeping.
+    bool idle = !activeClient && busState == BusState::Idle;
+    uint32_t timeout = self->waitTimeout();
+    self->waiter.clear();
+    for (size_t i = 0; i < self->clients.size(); ++i) {
+      AbstractClient* client = self->clients[i].get();
+      if (idle ? client->isWriteCapable()
+               : client == activeClient && busState == BusState::Transmit) {
+        // data already buffered by WiFiClient does not wake up select
+        if (client->available()) timeout = CLIENT_RETRY_MICROS;
+        client->watch(self->waiter);
       }
     }
+    self->waiter.wait(timeout, &ClientManager::busBytesQueued);
+  }
+}
+
+void ClientManager::setPolicy(ClientPolicy policy) { this->policy = policy; }
+
+AbstractClient* ClientManager::selectClient() {
+  uint32_t now = micros();
+  AbstractClient* selected = nullptr;
+  size_t index = 0;
+  int32_t totalWeight = 0;
+
+  for (size_t n = 0; n < clients.size(); ++n) {
+    // the round robin starts after the client served last
+    size_t i = (nextClient + n) % clients.size();
+    AbstractClient* client = clients[i].get();
+    ClientAccess& access = client->access;
+    if (!client->isConnected() || !client->isWriteCapable() ||
+        !client->available()) {
+      access.waiting = false;
+      continue;
+    }
+    if (!access.waiting) {
+      access.waiting = true;
+      access.since = now;
+    }
+
+    bool better = selected == nullptr;
+    switch (policy) {
+      case ClientPolicy::RoundRobin:
+        break;
+      case ClientPolicy::Weighted:
+        // smooth weighted round robin: the largest credit wins and pays for
+        // the turns of all the others
+        access.credit += access.weight;
+        totalWeight += access.weight;
+        better = better || access.credit > selected->access.credit;
+        break;
+      case ClientPolicy::Fifo:
+        better = better || static_cast<int32_t>(
+                               access.since - selected->access.since) < 0;
+        break;
+    }
+    if (better) {
+      selected = client;
+      index = i;
+    }
+  }
 
-    vTaskDelay(pdMS_TO_TICKS(1));
+  if (selected) {
+    ClientAccess& access = selected->access;
+    uint32_t wait = now - access.since;
+    access.credit -= totalWeight;
+    access.waiting = false;
+    access.granted++;
+    access.waitTotal += wait;
+    if (wait > access.waitMax) access.waitMax = wait;
+    nextClient = index + 1;
   }
+  return selected;
 }
 
 void ClientManager::acceptClients() {
+  xSemaphoreTake(clientsMutex, portMAX_DELAY);
+
   // Accept read-only clients
   while (readonlyServer.hasClient()) {
     WiFiClient* client = new WiFiClient(readonlyServer.accept());
     client->setNoDelay(true);
     clients.push_back(make_unique<ReadOnlyClient>(client, request));
+    clients.back()->resetCursor(clientRing);
   }
 
   // Accept regular clients
@@ -491,6 +1065,8 @@ void ClientManager::acceptClients() {
     WiFiClient* client = new WiFiClient(regularServer.accept());
     client->setNoDelay(true);
     clients.push_back(make_unique<RegularClient>(client, request));
+    clients.back()->resetCursor(clientRing);
+    clients.back()->access.weight = CLIENT_WEIGHT_REGULAR;
   }
 
   // Accept enhanced clients
@@ -498,19 +1074,79 @@ void ClientManager::acceptClients() {
     WiFiClient* client = new WiFiClient(enhancedServer.accept());
     client->setNoDelay(true);
     clients.push_back(make_unique<EnhancedClient>(client, request));
+    clients.back()->resetCursor(clientRing);
+    clients.back()->access.weight = CLIENT_WEIGHT_ENHANCED;
+  }
+
+  // Accept telegram clients
+  while (telegramServer.hasClient()) {
+    WiFiClient* client = new WiFiClient(telegramServer.accept());
+    client->setNoDelay(true);
+    clients.push_back(make_unique<TelegramClient>(client, request));
+    clients.back()->resetCursor(clientRing);
   }
 
   // Clean up disconnected clients
   clients.erase(
       std::remove_if(clients.begin(), clients.end(),
-                     [](const std::unique_ptr<AbstractClient>& client) {
+                     [this](const std::unique_ptr<AbstractClient>& client) {
                        if (!client->isConnected()) {
                          client->stop();  // <-- ensure socket is closed
+                         if (client->overflowed()) overflowDisconnects++;
+                         // its slot is recompiled by updateFilters
+                         if (client->filter.active) filtersChanged = true;
                          return true;
                        }
                        return false;
                      }),
       clients.end());
+
+  xSemaphoreGive(clientsMutex);
+}
+
+const std::string ClientManager::getClientsJson() {
+  std::string payload;
+  JsonDocument doc;
+
+  const char* policies[] = {"RoundRobin", "Weighted", "Fifo"};
+  doc["Policy"] = policies[static_cast<int>(policy)];
+  doc["Backlog_Size"] = CLIENT_BACKLOG_SIZE;
+  doc["Overflow_Disconnects"] = overflowDisconnects;
+  doc["Filter_Overflows"] = filterOverflows;
+  doc["Telegram_Overflows"] = telegramOverflows.load();
+
+  JsonArray Clients = doc["Clients"].to<JsonArray>();
+  if (clientsMutex) {
+    xSemaphoreTake(clientsMutex, portMAX_DELAY);
+    for (const std::unique_ptr<AbstractClient>& client : clients) {
+      JsonObject Client = Clients.add<JsonObject>();
+      Client["Type"] = client->type();
+      Client["Connected"] = client->isConnected();
+      Client["Lagging"] = client->behind(clientRing);
+      Client["Dropped"] = client->dropped();
+      Client["Backlog"] = client->backlog();
+      Client["Backlog_Max"] = client->backlogMax();
+      const ClientAccess& access = client->access;
+      Client["Weight"] = access.weight;
+      Client["Granted"] = access.granted;
+      Client["Wait_Avg"] =
+          access.granted > 0
+              ? static_cast<uint32_t>(access.waitTotal / access.granted)
+              : 0;
+      Client["Wait_Max"] = access.waitMax;
+      Client["Bus_Bytes"] = access.bytes;
+      if (client->filter.active) {
+        Client["Filter_Forwarded"] = client->filter.forwarded;
+        Client["Filter_Saved"] = client->filter.saved;
+      }
+    }
+    xSemaphoreGive(clientsMutex);
+  }
+
+  doc.shrinkToFit();
+  serializeJson(doc, payload);
+
+  return payload;
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#if defined(EBUS_INTERNAL)
+#include "filter.hpp"
+
+#include <ArduinoJson.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+// Parses one or two bytes of hex, returns the number of bytes or 0
+static int parseHex(const char* hex, uint16_t& value) {
+  size_t len = hex ? strlen(hex) : 0;
+  if (len != 2 && len != 4) return 0;
+  // strtoul would accept a sign or a 0x prefix
+  for (size_t i = 0; i < len; i++) {
+    if (!isxdigit(static_cast<unsigned char>(hex[i]))) return 0;
+  }
+  value = strtoul(hex, nullptr, 16);
+  return len / 2;
+}
+
+static bool parseAddresses(JsonVariantConst list, bool& any,
+                           uint32_t (&bits)[8]) {
+  if (list.isNull()) return true;
+  if (!list.is<JsonArrayConst>()) return false;
+  for (JsonVariantConst entry : list.as<JsonArrayConst>()) {
+    uint16_t address;
+    if (parseHex(entry.as<const char*>(), address) != 1) return false;
+    if (address > 0xff) return false;
+    bits[address >> 5] |= 1UL << (address & 31);
+    any = false;
+  }
+  return true;
+}
+
+bool FilterSpec::parse(const char* line) {
+  JsonDocument doc;
+  if (deserializeJson(doc, line) != DeserializationError::Ok ||
+      !doc.is<JsonObject>())
+    return false;
+
+  *this = FilterSpec();
+  if (!parseAddresses(doc["QQ"], anyQQ, qq)) return false;
+  if (!parseAddresses(doc["ZZ"], anyZZ, zz)) return false;
+
+  JsonVariantConst list = doc["PBSB"];
+  if (list.isNull()) return true;
+  if (!list.is<JsonArrayConst>()) return false;
+  for (JsonVariantConst entry : list.as<JsonArrayConst>()) {
+    if (prefixes == FILTER_PBSB_MAX) return false;
+    uint16_t value;
+    int bytes = parseHex(entry.as<const char*>(), value);
+    if (bytes == 0) return false;
+    pbsb[prefixes] = bytes == 1 ? value << 8 : value;
+    mask[prefixes] = bytes == 1 ? 0xff00 : 0xffff;
+    prefixes++;
+  }
+  return true;
+}
+
+void FilterTable::clear() {
+  memset(qq, 0, sizeof(qq));
+  memset(zz, 0, sizeof(zz));
+  anyPbsb = 0;
+  count = 0;
+}
+
+void FilterTable::add(uint8_t slot, const FilterSpec& spec) {
+  uint32_t bit = 1UL << slot;
+  for (int i = 0; i < 256; i++) {
+    if (spec.anyQQ || (spec.qq[i >> 5] & (1UL << (i & 31)))) qq[i] |= bit;
+    if (spec.anyZZ || (spec.zz[i >> 5] & (1UL << (i & 31)))) zz[i] |= bit;
+  }
+
+  if (spec.prefixes == 0) anyPbsb |= bit;
+  for (uint8_t p = 0; p < spec.prefixes; p++) {
+    // clients with the same prefix share its entry
+    size_t i = 0;
+    while (i < count && (prefixes[i].pbsb != spec.pbsb[p] ||
+                         prefixes[i].mask != spec.mask[p]))
+      i++;
+    if (i == count) prefixes[count++] = {spec.pbsb[p], spec.mask[p], 0};
+    prefixes[i].slots |= bit;
+  }
+}
+
+uint32_t FilterTable::match(uint8_t qq, uint8_t zz, uint8_t pb,
+                            uint8_t sb) const {
+  uint32_t slots = this->qq[qq] & this->zz[zz];
+  if (slots == 0) return 0;
+
+  uint16_t pbsb = pb << 8 | sb;
+  uint32_t prefixed = anyPbsb;
+  for (size_t i = 0; i < count; i++) {
+    if ((pbsb & prefixes[i].mask) == prefixes[i].pbsb)
+      prefixed |= prefixes[i].slots;
+  }
+  return slots & prefixed;
+}
+#endif
@@ -1,5 +1,7 @@
 #include "http.hpp"
 
+#include "arbiter.hpp"
+#include "client.hpp"
 #include "log.hpp"
 #include "main.hpp"
 #include "mqttha.hpp"
@@ -15,6 +17,13 @@ void handleGetStatus() {
                     getStatusJson().c_str());
 }
 
+#if !defined(EBUS_INTERNAL)
+void handleGetArbitration() {
+  configServer.send(200, "application/json;charset=utf-8",
+                    getArbitrationJson().c_str());
+}
+#endif
+
 #if defined(EBUS_INTERNAL)
 void handleCommandsList() {
   configServer.send(200, "application/json;charset=utf-8",
@@ -176,6 +185,16 @@ void handleGetCounter() {
                     schedule.getCounterJson().c_str());
 }
 
+void handleGetClients() {
+  configServer.send(200, "application/json;charset=utf-8",
+                    clientManager.getClientsJson().c_str());
+}
+
+void handleGetArbiter() {
+  configServer.send(200, "application/json;charset=utf-8",
+                    arbiter.getArbiterJson().c_str());
+}
+
 void handleGetTiming() {
   configServer.send(200, "application/json;charset=utf-8",
                     schedule.getTimingJson().c_str());
@@ -213,6 +232,9 @@ void SetupHttpHandlers() {
   configServer.on("/", [] { handleRoot(); });
   configServer.on("/status", [] { handleStatus(); });
   configServer.on("/api/v1/GetStatus", [] { handleGetStatus(); });
+#if !defined(EBUS_INTERNAL)
+  configServer.on("/api/v1/GetArbitration", [] { handleGetArbitration(); });
+#endif
 #if defined(EBUS_INTERNAL)
   configServer.on("/commands/list", [] { handleCommandsList(); });
   configServer.on("/commands/download", [] { handleCommandsDownload(); });
@@ -229,6 +251,8 @@ void SetupHttpHandlers() {
   configServer.on("/participants", [] { handleParticipants(); });
   configServer.on("/api/v1/GetCounter", [] { handleGetCounter(); });
   configServer.on("/api/v1/GetTiming", [] { handleGetTiming(); });
+  configServer.on("/api/v1/GetClients", [] { handleGetClients(); });
+  configServer.on("/api/v1/GetArbiter", [] { handleGetArbiter(); });
   configServer.on("/reset", [] { handleResetStatistic(); });
   configServer.on("/log", [] { handleLog(); });
   configServer.on("/logdata", [] { handleLogData(); });
@@ -11,6 +11,7 @@
 #include "log.hpp"
 #include "mqtt.hpp"
 #include "mqttha.hpp"
+#include "multicast.hpp"
 #include "schedule.hpp"
 #include "track.hpp"
 #else
@@ -25,6 +26,7 @@
 #include "esp32c3/rom/rtc.h"
 #include "esp_sntp.h"
 #include "http.hpp"
+#include "waiter.hpp"
 
 HTTPUpdateServer httpUpdater;
 
@@ -46,8 +48,13 @@ Preferences preferences;
 #define HOSTNAME "esp-eBus"
 
 // IotWebConf
-// adjust this if the iotwebconf structure has changed
+// adjust this if the iotwebconf structure has changed; this resets all
+// settings of the upgraded devices, note it in README.md
+#if defined(EBUS_INTERNAL)
+#define CONFIG_VERSION "eec"
+#else
 #define CONFIG_VERSION "eeb"
+#endif
 
 #define STRING_LEN 64
 #define DNS_LEN 255
@@ -68,6 +75,9 @@ Preferences preferences;
 #define DUMMY_MQTT_USER "roger"
 #define DUMMY_MQTT_PASS "password"
 
+#define DUMMY_UDP_GROUP MULTICAST_GROUP
+#define DUMMY_UDP_PORT "3337"
+
 char unique_id[7]{};
 
 DNSServer dnsServer;
@@ -106,6 +116,10 @@ char mqttPublishCounterValue[STRING_LEN];
 char mqttPublishTimingValue[STRING_LEN];
 
 char haEnabledValue[STRING_LEN];
+
+char udpEnabledValue[STRING_LEN];
+char udp_group[STRING_LEN];
+char udp_port[NUMBER_LEN];
 #endif
 
 IotWebConf iotWebConf(HOSTNAME, &dnsServer, &configServer, DEFAULT_APMODE_PASS,
@@ -191,6 +205,18 @@ iotwebconf::ParameterGroup haGroup =
     iotwebconf::ParameterGroup("ha", "Home Assistant configuration");
 iotwebconf::CheckboxParameter haEnabledParam = iotwebconf::CheckboxParameter(
     "Home Assistant enabled", "haEnabledParam", haEnabledValue, STRING_LEN);
+
+iotwebconf::ParameterGroup udpGroup =
+    iotwebconf::ParameterGroup("udp", "UDP telegram multicast");
+iotwebconf::CheckboxParameter udpEnabledParam = iotwebconf::CheckboxParameter(
+    "UDP multicast enabled", "udpEnabledParam", udpEnabledValue, STRING_LEN);
+iotwebconf::TextParameter udpGroupParam =
+    iotwebconf::TextParameter("Multicast group or broadcast address",
+                              "udp_group", udp_group, STRING_LEN,
+                              DUMMY_UDP_GROUP, DUMMY_UDP_GROUP);
+iotwebconf::NumberParameter udpPortParam = iotwebconf::NumberParameter(
+    "UDP port", "udp_port", udp_port, NUMBER_LEN, DUMMY_UDP_PORT,
+    "1..65535", "min='1' max='65535' step='1'");
 #endif
 
 IPAddress ipAddress;
@@ -206,6 +232,31 @@ WiFiClient wifiClientsEnhanced[MAX_WIFI_CLIENTS];
 
 WiFiServer wifiServerReadOnly(3334);
 WiFiClient wifiClientsReadOnly[MAX_WIFI_CLIENTS];
+
+// bus data for all clients, each with its own read cursor
+ClientRing clientRing;
+ClientCursor wifiCursors[MAX_WIFI_CLIENTS];
+ClientCursor wifiCursorsEnhanced[MAX_WIFI_CLIENTS];
+ClientCursor wifiCursorsReadOnly[MAX_WIFI_CLIENTS];
+
+PortStatistics wifiStatistics;
+PortStatistics wifiStatisticsEnhanced;
+PortStatistics wifiStatisticsReadOnly;
+
+// data_loop sleeps until a client or the bus has data, at most this long
+#define DATA_LOOP_TIMEOUT_MICROS 10000
+// and retries this often while a client is overdue but its socket is full
+#define DATA_LOOP_RETRY_MICROS 1000
+
+SocketWaiter dataWaiter;
+uint32_t dataLoopLoad = 0;  // per mille of the cpu used by data_loop
+uint32_t dataLoopWakeups = 0;
+uint32_t dataLoopTimeouts = 0;
+
+// clients that are sending on the bus get their data without delay until the
+// next SYN
+uint8_t activeClient = NO_CLIENT;
+uint8_t activeClientEnhanced = NO_CLIENT;
 #endif
 
 WiFiServer statusServer(5555);
@@ -344,46 +395,138 @@ void loop_duration() {
 }
 
 #if !defined(EBUS_INTERNAL)
+void drainClients(bool force) {
+  uint32_t now = micros();
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    if (force || i == activeClient ||
+        drainDue(clientRing, wifiCursors[i], now)) {
+      if (drainClient(&wifiClients[i], clientRing, wifiCursors[i],
+                      wifiStatistics)) {
+        updateLastComms();
+      }
+    }
+    if (force || drainDue(clientRing, wifiCursorsReadOnly[i], now)) {
+      if (drainClient(&wifiClientsReadOnly[i], clientRing,
+                      wifiCursorsReadOnly[i], wifiStatisticsReadOnly)) {
+        updateLastComms();
+      }
+    }
+    if (force || i == activeClientEnhanced ||
+        drainDue(clientRing, wifiCursorsEnhanced[i], now)) {
+      if (drainClientEnhanced(&wifiClientsEnhanced[i], clientRing,
+                              wifiCursorsEnhanced[i], wifiStatisticsEnhanced,
+                              i)) {
+        updateLastComms();
+      }
+    }
+  }
+}
+
+void updatePortStatistics(PortStatistics& statistics) {
+  statistics.packetsPerSecond = statistics.packets - statistics.lastPackets;
+  statistics.lastPackets = statistics.packets;
+}
+
 void data_process() {
   loop_duration();
 
   // check clients for data
   for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
-    handleClient(&wifiClients[i]);
+    if (handleClient(&wifiClients[i])) {
+      activeClient = i;
+    }
     handleClientEnhanced(&wifiClientsEnhanced[i]);
   }
 
-  // check queue for data
+  // move the queued bus data to the client ring
+  uint32_t now = micros();
+  bool syn = false;
   BusType::data d;
-  if (Bus.read(d)) {
+  for (int n = 0; n < CLIENT_DRAIN_RECORDS && Bus.read(d); n++) {
+    clientRing.push(d, now);
+    if (d._flags & BusType::DATA_ENHANCED) {
+      if (d._client < MAX_WIFI_CLIENTS) {
+        // the arbitrating client needs the result right away
+        wifiCursorsEnhanced[d._client].urgent = true;
+        if (d._c == STARTED) activeClientEnhanced = d._client;
+      }
+    } else if (d._d == SYN) {
+      syn = true;
+      activeClient = NO_CLIENT;
+      activeClientEnhanced = NO_CLIENT;
+    }
+  }
+
+  drainClients(syn);
+
+  // a client that went away must not hold up the arbitration queue
+  if (syn) {
     for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
-      if (d._enhanced) {
-        if (d._client == &wifiClientsEnhanced[i]) {
-          if (pushClientEnhanced(&wifiClientsEnhanced[i], d._c, d._d, true)) {
-            updateLastComms();
-          }
-        }
-      } else {
-        if (pushClient(&wifiClients[i], d._d)) {
-          updateLastComms();
-        }
-        if (pushClient(&wifiClientsReadOnly[i], d._d)) {
-          updateLastComms();
-        }
-        if (d._client != &wifiClientsEnhanced[i]) {
-          if (pushClientEnhanced(&wifiClientsEnhanced[i], d._c, d._d,
-                                 d._logtoclient == &wifiClientsEnhanced[i])) {
-            updateLastComms();
-          }
-        }
+      if (!wifiClientsEnhanced[i]) {
+        clearArbitrationClient(&wifiClientsEnhanced[i]);
       }
     }
   }
+
+  static uint32_t lastStatistics = 0;
+  if (millis() - lastStatistics >= 1000) {
+    lastStatistics = millis();
+    updatePortStatistics(wifiStatistics);
+    updatePortStatistics(wifiStatisticsEnhanced);
+    updatePortStatistics(wifiStatisticsReadOnly);
+  }
+}
+
+// Time until the next client is due for a drain
+uint32_t drainTimeout() {
+  uint32_t timeout = DATA_LOOP_TIMEOUT_MICROS;
+  uint32_t now = micros();
+  auto check = [&](const ClientCursor& cursor) {
+    if (clientRing.pending(cursor) == 0) return;
+    uint32_t age = now - clientRing.oldest(cursor);
+    uint32_t left = age < CLIENT_FLUSH_MICROS ? CLIENT_FLUSH_MICROS - age
+                                               : DATA_LOOP_RETRY_MICROS;
+    if (left < timeout) timeout = left;
+  };
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    check(wifiCursors[i]);
+    check(wifiCursorsEnhanced[i]);
+    check(wifiCursorsReadOnly[i]);
+  }
+  return timeout;
 }
 
+bool busDataQueued() { return Bus.queued() > 0; }
+
 void data_loop(void* pvParameters) {
+  uint32_t windowStart = micros();
+  uint32_t windowBusy = 0;
+  uint32_t windowWakeups = 0;
   while (1) {
+    // sleep until a client sent something, the bus has data or a client is
+    // due for a drain; new clients are picked up at the latest on timeout
+    dataWaiter.clear();
+    for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+      dataWaiter.add(&wifiClients[i]);
+      dataWaiter.add(&wifiClientsEnhanced[i]);
+    }
+    if (!dataWaiter.wait(drainTimeout(), busDataQueued)) dataLoopTimeouts++;
+
+    uint32_t begin = micros();
     data_process();
+
+    // cpu time spent by this task, the share is in per mille of the last
+    // second
+    uint32_t end = micros();
+    windowBusy += end - begin;
+    windowWakeups++;
+    if (end - windowStart >= 1000000) {
+      dataLoopLoad = uint64_t(windowBusy) * 1000 / (end - windowStart);
+      dataLoopWakeups = windowWakeups;
+      windowBusy = 0;
+      windowWakeups = 0;
+      windowStart = end;
+    }
   }
 }
 #endif
@@ -455,6 +598,12 @@ bool formValidator(iotwebconf::WebRequestWrapper* webRequestWrapper) {
     mqttServerParam.errorMessage = tmp.c_str();
     valid = false;
   }
+
+  IPAddress udpAddress;
+  if (!udpAddress.fromString(webRequestWrapper->arg(udpGroupParam.getId()))) {
+    udpGroupParam.errorMessage = "Please provide a valid IPv4 address!";
+    valid = false;
+  }
 #endif
 
   return valid;
@@ -493,6 +642,9 @@ void saveParamsCallback() {
   mqttha.setEnabled(haEnabledParam.isChecked());
   mqttha.publishDeviceInfo();
   mqttha.publishComponents();
+
+  multicast.setGroup(udp_group, atoi(udp_port));
+  multicast.setEnabled(udpEnabledParam.isChecked());
 #endif
 }
 
@@ -605,6 +757,11 @@ char* status_string() {
 
   pos += snprintf(status + pos, bufferSize - pos, "ha_enabled: %s\r\n",
                   haEnabledParam.isChecked() ? "true" : "false");
+
+  pos += snprintf(status + pos, bufferSize - pos, "udp_enabled: %s\r\n",
+                  udpEnabledParam.isChecked() ? "true" : "false");
+  pos += snprintf(status + pos, bufferSize - pos, "udp_group: %s:%i\r\n",
+                  udp_group, atoi(udp_port));
 #endif
 
   if (pos >= bufferSize) status[bufferSize - 1] = '\0';
@@ -612,6 +769,17 @@ char* status_string() {
   return status;
 }
 
+template <typename H>
+void addHistogram(JsonObject obj, const H& histogram) {
+  obj["Min"] = static_cast<int32_t>(H::MIN);
+  obj["Width"] = static_cast<int32_t>(H::WIDTH);
+  obj["Count"] = histogram.count();
+  obj["Below"] = histogram.below();
+  obj["Above"] = histogram.above();
+  JsonArray Bins = obj["Bins"].to<JsonArray>();
+  for (size_t i = 0; i < H::BINS; i++) Bins.add(histogram.bin(i));
+}
+
 const std::string getStatusJson() {
   std::string payload;
   JsonDocument doc;
@@ -639,8 +807,114 @@ const std::string getStatusJson() {
   Arbitration["Won2"] = static_cast<int>(Bus._nbrWon2);
   Arbitration["Lost1"] = static_cast<int>(Bus._nbrLost1);
   Arbitration["Lost2"] = static_cast<int>(Bus._nbrLost2);
+  Arbitration["Retries"] = static_cast<int>(Bus._nbrRetries);
+  Arbitration["Retries_Won"] = static_cast<int>(Bus._nbrRetriesWon);
+  Arbitration["Retries_Max"] = ARBITRATION_RETRIES;
   Arbitration["Late"] = static_cast<int>(Bus._nbrLate);
   Arbitration["Errors"] = static_cast<int>(Bus._nbrErrors);
+  Arbitration["Collisions"] = static_cast<int>(Bus._nbrCollisions);
+  Arbitration["Echo_Missing"] = static_cast<int>(Bus._nbrEchoMissing);
+  Arbitration["Echo_Untracked"] = static_cast<int>(Bus._nbrEchoUntracked);
+  Arbitration["Latency"] = Bus.arbitration().latency();
+  Arbitration["Latency_Variance"] = Bus.arbitration().latencyVariance();
+  Arbitration["Latency_Samples"] = Bus.arbitration().latencySamples();
+  Arbitration["Echoes"] = Bus.arbitration().echoes();
+  Arbitration["Window_Hits"] = Bus.arbitration().windowHits();
+  Arbitration["Prearms"] = Bus.arbitration().prearms();
+  Arbitration["Prearm_Misses"] = Bus.arbitration().prearmMisses();
+  Arbitration["Prearm_Orphans"] = Bus.arbitration().prearmOrphans();
+  Arbitration["Window_Hit_Rate"] =
+      Bus.arbitration().echoes() > 0
+          ? 100.0f * Bus.arbitration().windowHits() / Bus.arbitration().echoes()
+          : 0.0f;
+
+  // Pending arbitration requests per enhanced client
+  Arbitration["Queued"] = arbitrationQueued();
+  ArbitrationWait waits[MAX_WIFI_CLIENTS];
+  getArbitrationWaits(waits);
+  JsonArray Waits = Arbitration["Clients"].to<JsonArray>();
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    JsonObject Wait = Waits.add<JsonObject>();
+    Wait["Requests"] = waits[i].requests;
+    Wait["Served"] = waits[i].served;
+    Wait["Cancelled"] = waits[i].cancelled;
+    Wait["Wait_Avg"] = waits[i].served > 0
+                           ? static_cast<uint32_t>(waits[i].totalWait /
+                                                   waits[i].served)
+                           : 0;
+    Wait["Wait_Max"] = waits[i].maxWait;
+  }
+
+  // Telegrams
+  const TelegramDecoder& telegrams = Bus.telegrams();
+  JsonObject Telegrams = doc["Telegrams"].to<JsonObject>();
+  Telegrams["Total"] = static_cast<int>(telegrams._telegrams);
+  Telegrams["Broadcast"] = static_cast<int>(telegrams._broadcast);
+  Telegrams["Master_Master"] = static_cast<int>(telegrams._masterMaster);
+  Telegrams["Master_Slave"] = static_cast<int>(telegrams._masterSlave);
+  Telegrams["Crc_Errors"] = static_cast<int>(telegrams._crcErrors);
+  Telegrams["Slave_Crc_Errors"] = static_cast<int>(telegrams._slaveCrcErrors);
+  Telegrams["Naks"] = static_cast<int>(telegrams._naks);
+  Telegrams["Slave_Naks"] = static_cast<int>(telegrams._slaveNaks);
+  Telegrams["Aborted"] = static_cast<int>(telegrams._aborted);
+  JsonArray Sizes = Telegrams["Sizes"].to<JsonArray>();
+  for (uint32_t count : telegrams._sizes) Sizes.add(count);
+  // only the addresses that have been seen, keyed by the address in hex
+  JsonObject Sources = Telegrams["Sources"].to<JsonObject>();
+  JsonObject Targets = Telegrams["Targets"].to<JsonObject>();
+  for (int i = 0; i < 256; i++) {
+    char address[3];
+    snprintf(address, sizeof(address), "%02x", i);
+    if (telegrams._sources[i] > 0) Sources[address] = telegrams._sources[i];
+    if (telegrams._targets[i] > 0) Targets[address] = telegrams._targets[i];
+  }
+
+  // Queue
+  JsonObject Queue = doc["Queue"].to<JsonObject>();
+  Queue["Capacity"] = Bus.queueCapacity();
+  Queue["Max_Queued"] = static_cast<int>(Bus._maxQueued);
+  Queue["Overflows"] = static_cast<int>(Bus._nbrOverflows);
+
+  // Serial reader task
+  JsonObject Reader = doc["Reader"].to<JsonObject>();
+  Reader["Cpu_Time"] = static_cast<int>(Bus._readerCpuTime);
+  Reader["Load"] = static_cast<int>(Bus._readerLoad);
+  Reader["Stack_Free"] = Bus.readerStackFree();
+
+  // Data loop task
+  JsonObject DataLoop = doc["Data_Loop"].to<JsonObject>();
+  DataLoop["Load"] = dataLoopLoad;
+  DataLoop["Wakeups_Per_Second"] = dataLoopWakeups;
+  DataLoop["Timeouts"] = dataLoopTimeouts;
+
+  // Clients
+  auto addPortStatistics = [](JsonObject obj,
+                              const PortStatistics& statistics) {
+    obj["Packets"] = statistics.packets;
+    obj["Bytes"] = statistics.bytes;
+    obj["Packets_Per_Second"] = statistics.packetsPerSecond;
+    obj["Bytes_Per_Packet"] =
+        statistics.packets > 0
+            ? static_cast<float>(statistics.bytes) / statistics.packets
+            : 0.0f;
+    obj["Dropped"] = statistics.dropped;
+  };
+  addPortStatistics(doc["Clients"]["Regular"].to<JsonObject>(),
+                    wifiStatistics);
+  addPortStatistics(doc["Clients"]["ReadOnly"].to<JsonObject>(),
+                    wifiStatisticsReadOnly);
+  addPortStatistics(doc["Clients"]["Enhanced"].to<JsonObject>(),
+                    wifiStatisticsEnhanced);
+  doc["Clients"]["Flush_Micros"] = CLIENT_FLUSH_MICROS;
+  doc["Clients"]["Ring_Size"] = clientRing.capacity();
+#else
+  // Clients
+  doc["Clients"]["Dropped"] = clientManager.dropped();
+  doc["Clients"]["Ring_Size"] = CLIENT_RING_SIZE;
+  addHistogram(doc["Clients"]["Latency"].to<JsonObject>(),
+               clientManager.latency());
+  addHistogram(doc["Clients"]["Transmit_Gaps"].to<JsonObject>(),
+               clientManager.transmitGaps());
 #endif
 
   // Firmware
@@ -715,6 +989,14 @@ const std::string getStatusJson() {
   // HomeAssistant
   JsonObject HomeAssistant = doc["Home_Assistant"].to<JsonObject>();
   HomeAssistant["Enabled"] = haEnabledParam.isChecked();
+
+  // UDP
+  JsonObject UDP = doc["UDP"].to<JsonObject>();
+  UDP["Enabled"] = udpEnabledParam.isChecked();
+  UDP["Group"] = udp_group;
+  UDP["Port"] = atoi(udp_port);
+  UDP["Sent"] = multicast.sent();
+  UDP["Failed"] = multicast.failed();
 #endif
 
   doc.shrinkToFit();
@@ -723,6 +1005,30 @@ const std::string getStatusJson() {
   return payload;
 }
 
+#if !defined(EBUS_INTERNAL)
+const std::string getArbitrationJson() {
+  std::string payload;
+  JsonDocument doc;
+
+  const char* outcomes[] = {"Won", "Lost", "Late"};
+  for (int i = Arbitration::outcomeWon; i <= Arbitration::outcomeLate; i++) {
+    const Arbitration::Timing& timing =
+        Bus.arbitration().timing(static_cast<Arbitration::outcome>(i));
+    JsonObject Outcome = doc[outcomes[i]].to<JsonObject>();
+    addHistogram(Outcome["Send"].to<JsonObject>(), timing.send);
+    // late attempts are given up before a delay or gap exists
+    if (i == Arbitration::outcomeLate) continue;
+    addHistogram(Outcome["Delay"].to<JsonObject>(), timing.delay);
+    addHistogram(Outcome["Gap"].to<JsonObject>(), timing.gap);
+  }
+
+  doc.shrinkToFit();
+  serializeJson(doc, payload);
+
+  return payload;
+}
+#endif
+
 bool handleStatusServerRequests() {
   if (!statusServer.hasClient()) return false;
 
@@ -751,6 +1057,9 @@ void setup() {
 #if defined(EBUS_INTERNAL)
   ebus::setupBusIsr(UART_NUM_1, UART_RX, UART_TX, 1, 0);
 #else
+  setEnhancedClients(wifiClientsEnhanced);
+  dataWaiter.begin();
+  Bus.setReadCallback([]() { dataWaiter.signal(); });
   Bus.begin();
 #endif
 
@@ -793,6 +1102,10 @@ void setup() {
   mqttGroup.addItem(&mqttPublishTimingParam);
 
   haGroup.addItem(&haEnabledParam);
+
+  udpGroup.addItem(&udpEnabledParam);
+  udpGroup.addItem(&udpGroupParam);
+  udpGroup.addItem(&udpPortParam);
 #endif
 
   iotWebConf.addParameterGroup(&connGroup);
@@ -804,6 +1117,7 @@ void setup() {
   iotWebConf.addParameterGroup(&scheduleGroup);
   iotWebConf.addParameterGroup(&mqttGroup);
   iotWebConf.addParameterGroup(&haGroup);
+  iotWebConf.addParameterGroup(&udpGroup);
 #endif
   iotWebConf.setFormValidator(&formValidator);
   iotWebConf.setConfigSavedCallback(&saveParamsCallback);
@@ -865,6 +1179,9 @@ void setup() {
   mqttha.setWillTopic(mqtt.getWillTopic());
   mqttha.setEnabled(haEnabledParam.isChecked());
 
+  multicast.setGroup(udp_group, atoi(udp_port));
+  multicast.setEnabled(udpEnabledParam.isChecked());
+
   mqttha.setThingName(iotWebConf.getThingName());
   mqttha.setThingModel(ESP.getChipModel());
   mqttha.setThingModelId("Revision: " + std::to_string(ESP.getChipRevision()));
@@ -62,16 +62,15 @@ void Mqtt::enqueueOutgoing(const OutgoingAction& action) {
   mqtt.outgoingQueue.push(action);
 }
 
-void Mqtt::publishData(const std::string& id,
-                       const std::vector<uint8_t>& master,
-                       const std::vector<uint8_t>& slave) {
+void Mqtt::publishData(const std::string& id, ByteView master,
+                       ByteView slave) {
   if (!mqtt.enabled) return;
 
   std::string payload;
   JsonDocument doc;
   doc["id"] = id;
-  doc["master"] = ebus::to_string(master);
-  doc["slave"] = ebus::to_string(slave);
+  doc["master"] = toHex(master);
+  doc["slave"] = toHex(slave);
   doc.shrinkToFit();
   serializeJson(doc, payload);
   mqtt.publish("response", 0, false, payload.c_str());
@@ -0,0 +1,72 @@
+#if defined(EBUS_INTERNAL)
+#include "multicast.hpp"
+
+#include <lwip/sockets.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "client.hpp"
+
+TelegramMulticast multicast;
+
+void TelegramMulticast::setEnabled(bool enabled) { this->enabled = enabled; }
+
+bool TelegramMulticast::setGroup(const char* address, uint16_t port) {
+  in_addr parsed;
+  if (inet_aton(address, &parsed) == 0) return false;
+  group = parsed.s_addr;
+  this->port = port;
+  return true;
+}
+
+bool TelegramMulticast::isEnabled() const { return enabled; }
+
+void TelegramMulticast::send(const TelegramFrame& frame) {
+  if (!enabled || group == 0) {
+    if (sock >= 0) closeSocket();
+    return;
+  }
+  if (sock < 0 && !openSocket()) {
+    failedDatagrams++;
+    return;
+  }
+
+  uint8_t datagram[4 + TELEGRAM_FRAME_MAX];
+  for (int i = 0; i < 4; i++) datagram[i] = frame.sequence >> (8 * i);
+  size_t len = frame.len - 2;
+  memcpy(datagram + 4, frame.data + 2, len);
+
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_addr.s_addr = group;
+  to.sin_port = htons(port);
+
+  // never wait for the network, a full send buffer loses the telegram
+  if (sendto(sock, datagram, 4 + len, MSG_DONTWAIT,
+             reinterpret_cast<sockaddr*>(&to), sizeof(to)) < 0)
+    failedDatagrams++;
+  else
+    sentDatagrams++;
+}
+
+uint32_t TelegramMulticast::sent() const { return sentDatagrams; }
+
+uint32_t TelegramMulticast::failed() const { return failedDatagrams; }
+
+bool TelegramMulticast::openSocket() {
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) return false;
+
+  uint8_t ttl = MULTICAST_TTL;
+  int broadcast = 1;
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+  return true;
+}
+
+void TelegramMulticast::closeSocket() {
+  ::close(sock);
+  sock = -1;
+}
+#endif
@@ -1,8 +1,12 @@
 #if defined(EBUS_INTERNAL)
 #include "schedule.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <set>
 
+#include "arbiter.hpp"
+#include "client.hpp"
 #include "http.hpp"
 #include "log.hpp"
 #include "mqtt.hpp"
@@ -156,6 +160,8 @@ TRACK_TIMING(releaseBus, "handlerState/releaseBus");
 
 Schedule schedule;
 
+Schedule::Schedule() {}
+
 void Schedule::start(ebus::Request* request, ebus::Handler* handler) {
   ebusRequest = request;
   ebusHandler = handler;
@@ -167,30 +173,39 @@ void Schedule::start(ebus::Request* request, ebus::Handler* handler) {
                const ebus::TelegramType& telegramType,
                const std::vector<uint8_t>& master,
                const std::vector<uint8_t>& slave) {
-          CallbackEvent* event = new CallbackEvent();
-          event->type = CallbackType::telegram;
-          event->mode = mode;
+          TelegramFrame frame;
+          encodeTelegram(frame, micros(), static_cast<uint8_t>(messageType),
+                         static_cast<uint8_t>(telegramType), TELEGRAM_OK,
+                         master, slave);
+          clientManager.pushTelegram(frame);
+
+          CallbackEvent* event =
+              takeEvent(CallbackType::telegram, master, slave);
+          if (!event) return;
           event->data.messageType = messageType;
           event->data.telegramType = telegramType;
-          event->data.master = master;
-          event->data.slave = slave;
-          eventQueue.try_push(event);
+          queueEvent(event);
         });
 
     ebusHandler->setErrorCallback([this](const std::string& error,
                                          const std::vector<uint8_t>& master,
                                          const std::vector<uint8_t>& slave) {
-      CallbackEvent* event = new CallbackEvent();
-      event->type = CallbackType::error;
-      event->data.error = error;
-      event->data.master = master;
-      event->data.slave = slave;
-      eventQueue.try_push(event);
+      TelegramFrame frame;
+      encodeTelegram(frame, micros(), 0xff, 0xff, TELEGRAM_ERROR, master,
+                     slave);
+      clientManager.pushTelegram(frame);
+
+      CallbackEvent* event = takeEvent(CallbackType::error, master, slave);
+      if (!event) return;
+      strncpy(event->data.error, error.c_str(), SCHEDULE_EVENT_ERROR_MAX - 1);
+      event->data.error[SCHEDULE_EVENT_ERROR_MAX - 1] = '\0';
+      queueEvent(event);
     });
 
     // Start the scheduleRunner task
     xTaskCreate(&Schedule::taskFunc, "scheduleRunner", 4096, this, 2,
                 &scheduleTaskHandle);
+    arbiter.setWakeup(BusSource::schedule, &Schedule::arbiterReleased);
 
     // enqueue Inquiry of Existence at startup to discover all participants
     if (sendInquiryOfExistence)
@@ -470,6 +485,14 @@ const std::string Schedule::getCounterJson() {
   Error_Active["Slave"] = handlerCounter.errorActiveSlave;
   Error_Active["Slave_ACK"] = handlerCounter.errorActiveSlaveACK;
 
+  // Events
+  JsonObject Events = doc["Events"].to<JsonObject>();
+  Events["Queue_Size"] = SCHEDULE_EVENT_QUEUE_SIZE;
+  Events["Pool_Size"] = SCHEDULE_EVENT_POOL_SIZE;
+  Events["Free"] = events.free();
+  Events["Dropped"] = events.dropped();
+  Events["Exhausted"] = events.exhausted();
+
   doc.shrinkToFit();
   serializeJson(doc, payload);
 
@@ -723,53 +746,81 @@ void Schedule::taskFunc(void* arg) {
     if (self->stopRunner) vTaskDelete(NULL);
     self->handleEvents();
     self->handleCommands();
-    vTaskDelay(pdMS_TO_TICKS(10));  // adjust delay as needed
+    // woken early when the arbiter releases the bus
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));  // adjust delay as needed
   }
 }
 
+Schedule::CallbackEvent* Schedule::takeEvent(CallbackType type,
+                                              ByteView master, ByteView slave) {
+  CallbackEvent* event = events.take();
+  if (!event) return nullptr;
+
+  event->type = type;
+  event->mode = mode;
+  event->data.master.assign(master);
+  event->data.slave.assign(slave);
+  return event;
+}
+
+void Schedule::queueEvent(CallbackEvent* event) {
+  events.queue(eventQueue, event);
+}
+
 void Schedule::handleEvents() {
   CallbackEvent* event = nullptr;
   while (eventQueue.try_pop(event)) {
     if (event) {
-      std::string payload;
+      const ByteView master = event->data.master;
+      const ByteView slave = event->data.slave;
+
+      // formatted on the stack, a telegram needs no heap on its way
+      char masterHex[2 * TELEGRAM_MASTER_MAX + 1];
+      char slaveHex[2 * TELEGRAM_SLAVE_MAX + 1];
+      toHex(master, masterHex, sizeof(masterHex));
+      toHex(slave, slaveHex, sizeof(slaveHex));
+
+      char payload[LOG_ENTRY_LEN];
       switch (event->type) {
         case CallbackType::error: {
-          payload = event->data.error + " : master '" +
-                    ebus::to_string(event->data.master) + "' slave '" +
-                    ebus::to_string(event->data.slave) + "'";
+          snprintf(payload, sizeof(payload), "%s : master '%s' slave '%s'",
+                   event->data.error, masterHex, slaveHex);
+
+          // only an error of our own active message ends it, passive
+          // errors of other masters must not hand the bus to the clients
+          if (!master.empty() && master[0] == ebusHandler->getSourceAddress())
+            releaseArbiter();
 
           if (schedule.publishCounter) {
             std::string topic = "state/reset/last";
-            mqtt.publish(topic.c_str(), 0, false, payload.c_str());
+            mqtt.publish(topic.c_str(), 0, false, payload);
           }
         } break;
         case CallbackType::telegram: {
-          payload = ebus::to_string(event->data.master);
           if (event->data.telegramType != ebus::TelegramType::broadcast)
-            payload += " / " + ebus::to_string(event->data.slave);
-
-          if (!event->data.master.empty()) {
-            seenMasters[event->data.master[0]] += 1;
-            if (event->data.master.size() > 1 &&
-                ebus::isSlave(event->data.master[1]))
-              seenSlaves[event->data.master[1]] += 1;
+            snprintf(payload, sizeof(payload), "%s / %s", masterHex, slaveHex);
+          else
+            snprintf(payload, sizeof(payload), "%s", masterHex);
+
+          if (!master.empty()) {
+            seenMasters[master[0]] += 1;
+            if (master.size() > 1 && ebus::isSlave(master[1]))
+              seenSlaves[master[1]] += 1;
           }
 
           switch (event->data.messageType) {
             case ebus::MessageType::active:
-              schedule.processActive(event->mode,
-                                     std::vector<uint8_t>(event->data.master),
-                                     std::vector<uint8_t>(event->data.slave));
+              releaseArbiter();
+              schedule.processActive(event->mode, master, slave);
             case ebus::MessageType::passive:
             case ebus::MessageType::reactive:
-              schedule.processPassive(std::vector<uint8_t>(event->data.master),
-                                      std::vector<uint8_t>(event->data.slave));
+              schedule.processPassive(master, slave);
               break;
           }
         } break;
       }
-      addLog(payload.c_str());
-      delete event;
+      addLog(payload);
+      events.give(event);
     }
   }
 }
@@ -777,12 +828,24 @@ void Schedule::handleEvents() {
 void Schedule::handleCommands() {
   uint32_t currentMillis = millis();
 
+  // The handler gives up on an active message without a callback, e.g. after
+  // a lost arbitration it does not retry or a reset of the request. Once its
+  // request has been busy with the message and the bus is available again,
+  // the message is over either way.
+  if (arbiterHeld) {
+    if (!ebusRequest->busAvailable())
+      activeRequested = true;
+    else if (activeRequested)
+      releaseArbiter();
+  }
+
   // check if scheduleCommand is stuck
   if (scheduleCommand != nullptr && scheduleCommandSetTime > 0) {
     if (currentMillis - scheduleCommandSetTime > scheduleCommandTimeout) {
       // command is stuck, clear it so next can be enqueued
       scheduleCommand = nullptr;
       scheduleCommandSetTime = 0;  // clear after success
+      releaseArbiter();
     }
   }
 
@@ -792,9 +855,12 @@ void Schedule::handleCommands() {
   // enqueue next schedule command if needed
   if (store.active()) enqueueScheduleCommand();
 
-  // process queue
+  // process queue, once the arbiter hands over the bus
   if (!queuedCommands.empty() &&
-      currentMillis > lastCommand + distanceCommands) {
+      currentMillis > lastCommand + distanceCommands &&
+      arbiter.acquire(BusSource::schedule)) {
+    arbiterHeld = true;
+    activeRequested = false;
     lastCommand = currentMillis;
     QueuedCommand cmd = queuedCommands.front();
     queuedCommands.erase(queuedCommands.begin());
@@ -809,10 +875,24 @@ void Schedule::handleCommands() {
     if (fullScan && mode == Mode::fullscan) enqueueFullScanCommand();
 
     // send command
-    if (cmd.command.size() > 0) ebusHandler->enqueueActiveMessage(cmd.command);
+    if (cmd.command.size() > 0)
+      ebusHandler->enqueueActiveMessage(cmd.command);
+    else
+      releaseArbiter();
   }
 }
 
+void Schedule::releaseArbiter() {
+  if (!arbiterHeld) return;
+  arbiterHeld = false;
+  activeRequested = false;
+  arbiter.release(BusSource::schedule);
+}
+
+void Schedule::arbiterReleased() {
+  if (schedule.scheduleTaskHandle) xTaskNotifyGive(schedule.scheduleTaskHandle);
+}
+
 void Schedule::enqueueCommand(const QueuedCommand& cmd) {
   if (cmd.mode == Mode::schedule) {
     // only allow one schedule command in the queue
@@ -884,9 +964,8 @@ void Schedule::reactiveMasterSlaveCallback(const std::vector<uint8_t>& master,
   //   *slave = ebus::to_vector("0ahhggggggggggssrrhhrr");
 }
 
-void Schedule::processActive(const Mode& mode,
-                             const std::vector<uint8_t>& master,
-                             const std::vector<uint8_t>& slave) {
+void Schedule::processActive(const Mode& mode, ByteView master,
+                             ByteView slave) {
   switch (mode) {
     case Mode::schedule:
       if (scheduleCommand != nullptr) {
@@ -916,43 +995,45 @@ void Schedule::processActive(const Mode& mode,
   }
 }
 
-void Schedule::processPassive(const std::vector<uint8_t>& master,
-                              const std::vector<uint8_t>& slave) {
+void Schedule::processPassive(ByteView master, ByteView slave) {
   if (forward) {
     size_t count = std::count_if(forwardfilters.begin(), forwardfilters.end(),
                                  [&master](const std::vector<uint8_t>& vec) {
-                                   return ebus::contains(master, vec);
+                                   return master.contains(vec);
                                  });
     if (count > 0 || forwardfilters.size() == 0)
       mqtt.publishData("forward", master, slave);
   }
 
-  std::vector<Command*> pasCommands = store.updateData(nullptr, master, slave);
+  const std::vector<Command*>& pasCommands =
+      store.updateData(nullptr, master, slave);
 
-  for (const Command* command : pasCommands)
-    mqtt.publishValue(command, store.getValueJson(command));
+  // the values are only serialized for a connection that wants them
+  if (mqtt.isEnabled()) {
+    for (const Command* command : pasCommands)
+      mqtt.publishValue(command, store.getValueJson(command));
+  }
 
   processScan(master, slave);
 
   // send Sign of Life in response to an Inquiry of Existence
-  if (ebus::contains(master, VEC_07fe00, 2))
+  if (master.contains(VEC_07fe00, 2))
     enqueueCommand({Mode::internal, PRIO_INTERNAL, VEC_fe07ff00, nullptr});
 }
 
-void Schedule::processScan(const std::vector<uint8_t>& master,
-                           const std::vector<uint8_t>& slave) {
-  if (ebus::contains(master, VEC_070400, 2)) {
+void Schedule::processScan(ByteView master, ByteView slave) {
+  if (master.contains(VEC_070400, 2)) {
     allParticipants[master[1]].slave = master[1];
-    allParticipants[master[1]].vec_070400 = slave;
+    allParticipants[master[1]].vec_070400.assign(slave.begin(), slave.end());
   }
 
-  if (ebus::contains(master, VEC_b5090124, 2))
-    allParticipants[master[1]].vec_b5090124 = slave;
-  if (ebus::contains(master, VEC_b5090125, 2))
-    allParticipants[master[1]].vec_b5090125 = slave;
-  if (ebus::contains(master, VEC_b5090126, 2))
-    allParticipants[master[1]].vec_b5090126 = slave;
-  if (ebus::contains(master, VEC_b5090127, 2))
-    allParticipants[master[1]].vec_b5090127 = slave;
+  if (master.contains(VEC_b5090124, 2))
+    allParticipants[master[1]].vec_b5090124.assign(slave.begin(), slave.end());
+  if (master.contains(VEC_b5090125, 2))
+    allParticipants[master[1]].vec_b5090125.assign(slave.begin(), slave.end());
+  if (master.contains(VEC_b5090126, 2))
+    allParticipants[master[1]].vec_b5090126.assign(slave.begin(), slave.end());
+  if (master.contains(VEC_b5090127, 2))
+    allParticipants[master[1]].vec_b5090127.assign(slave.begin(), slave.end());
 }
 #endif
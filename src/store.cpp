@@ -1,6 +1,7 @@
 #if defined(EBUS_INTERNAL)
 #include "store.hpp"
 
+#include <Arduino.h>
 #include <Preferences.h>
 
 #include <regex>
@@ -492,47 +493,44 @@ Command* Store::nextActiveCommand() {
   return next;
 }
 
-std::vector<Command*> Store::findPassiveCommands(
-    const std::vector<uint8_t>& master) {
-  std::vector<Command*> commands;
+const std::vector<Command*>& Store::findPassiveCommands(ByteView master) {
+  foundCommands.clear();
   // Fast lookup by command pattern
-  auto it = passiveCommands.find(master);
+  lookupKey.assign(master.begin(), master.end());
+  auto it = passiveCommands.find(lookupKey);
   if (it != passiveCommands.end()) {
-    commands = it->second;
+    foundCommands.assign(it->second.begin(), it->second.end());
   } else {
     // fallback: scan for all that match (if needed)
     for (const auto& kv : passiveCommands) {
-      if (ebus::contains(master, kv.first))
-        commands.insert(commands.end(), kv.second.begin(), kv.second.end());
+      if (master.contains(kv.first))
+        foundCommands.insert(foundCommands.end(), kv.second.begin(),
+                             kv.second.end());
     }
   }
-  return commands;
+  return foundCommands;
 }
 
-std::vector<Command*> Store::updateData(Command* command,
-                                        const std::vector<uint8_t>& master,
-                                        const std::vector<uint8_t>& slave) {
+const std::vector<Command*>& Store::updateData(Command* command,
+                                               ByteView master,
+                                               ByteView slave) {
   if (command) {
-    command->last = millis();
-    if (command->master)
-      command->data =
-          ebus::range(master, 4 + command->position, command->length);
-    else
-      command->data = ebus::range(slave, command->position, command->length);
-    // Return a vector with just this command, but avoid heap allocation
-    return {command};
+    foundCommands.assign(1, command);
+  } else {
+    // Passive: potentially multiple matches
+    findPassiveCommands(master);
   }
 
-  // Passive: potentially multiple matches
-  std::vector<Command*> commands = findPassiveCommands(master);
-  for (Command* cmd : commands) {
+  for (Command* cmd : foundCommands) {
     cmd->last = millis();
-    if (cmd->master)
-      cmd->data = ebus::range(master, 4 + cmd->position, cmd->length);
-    else
-      cmd->data = ebus::range(slave, cmd->position, cmd->length);
+    // assign keeps the capacity of the data, so its size is only allocated
+    // once
+    ByteView data = cmd->master
+                        ? master.range(4 + cmd->position, cmd->length)
+                        : slave.range(cmd->position, cmd->length);
+    cmd->data.assign(data.begin(), data.end());
   }
-  return commands;
+  return foundCommands;
 }
 
 JsonDocument Store::getValueJson(const Command* command) {
@@ -0,0 +1,205 @@
+#include "telegram.hpp"
+
+#include "busstate.hpp"
+
+static const uint8_t CRC_TABLE[256] = {
+    0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f,
+    0xd8, 0x43, 0x75, 0xee, 0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5,
+    0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc, 0x64, 0xff, 0xc9, 0x52,
+    0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
+    0x56, 0xcd, 0xfb, 0x60, 0x97, 0x0c, 0x3a, 0xa1, 0x4f, 0xd4, 0xe2, 0x79,
+    0x8e, 0x15, 0x23, 0xb8, 0xc8, 0x53, 0x65, 0xfe, 0x09, 0x92, 0xa4, 0x3f,
+    0xd1, 0x4a, 0x7c, 0xe7, 0x10, 0x8b, 0xbd, 0x26, 0xfa, 0x61, 0x57, 0xcc,
+    0x3b, 0xa0, 0x96, 0x0d, 0xe3, 0x78, 0x4e, 0xd5, 0x22, 0xb9, 0x8f, 0x14,
+    0xac, 0x37, 0x01, 0x9a, 0x6d, 0xf6, 0xc0, 0x5b, 0xb5, 0x2e, 0x18, 0x83,
+    0x74, 0xef, 0xd9, 0x42, 0x9e, 0x05, 0x33, 0xa8, 0x5f, 0xc4, 0xf2, 0x69,
+    0x87, 0x1c, 0x2a, 0xb1, 0x46, 0xdd, 0xeb, 0x70, 0x0b, 0x90, 0xa6, 0x3d,
+    0xca, 0x51, 0x67, 0xfc, 0x12, 0x89, 0xbf, 0x24, 0xd3, 0x48, 0x7e, 0xe5,
+    0x39, 0xa2, 0x94, 0x0f, 0xf8, 0x63, 0x55, 0xce, 0x20, 0xbb, 0x8d, 0x16,
+    0xe1, 0x7a, 0x4c, 0xd7, 0x6f, 0xf4, 0xc2, 0x59, 0xae, 0x35, 0x03, 0x98,
+    0x76, 0xed, 0xdb, 0x40, 0xb7, 0x2c, 0x1a, 0x81, 0x5d, 0xc6, 0xf0, 0x6b,
+    0x9c, 0x07, 0x31, 0xaa, 0x44, 0xdf, 0xe9, 0x72, 0x85, 0x1e, 0x28, 0xb3,
+    0xc3, 0x58, 0x6e, 0xf5, 0x02, 0x99, 0xaf, 0x34, 0xda, 0x41, 0x77, 0xec,
+    0x1b, 0x80, 0xb6, 0x2d, 0xf1, 0x6a, 0x5c, 0xc7, 0x30, 0xab, 0x9d, 0x06,
+    0xe8, 0x73, 0x45, 0xde, 0x29, 0xb2, 0x84, 0x1f, 0xa7, 0x3c, 0x0a, 0x91,
+    0x66, 0xfd, 0xcb, 0x50, 0xbe, 0x25, 0x13, 0x88, 0x7f, 0xe4, 0xd2, 0x49,
+    0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba,
+    0x4d, 0xd6, 0xe0, 0x7b};
+
+uint8_t TelegramDecoder::crc8(uint8_t crc, uint8_t symbol) {
+  return CRC_TABLE[crc] ^ symbol;
+}
+
+void TelegramDecoder::data(uint8_t symbol) {
+  if (symbol == SYN) {
+    // a SYN after the master address is the second round of arbitration
+    if (_part != pIdle && _part != pQQ && _part != pZZ && _part != pDone) {
+      _aborted++;
+    }
+    _part = pQQ;
+    _crc = 0;
+    _escaped = false;
+    return;
+  }
+
+  if (_part == pIdle) return;
+  if (_part == pDone) {
+    // more data where a SYN was expected, e.g. from a participant that does
+    // not wait for the SYN
+    abort();
+    return;
+  }
+
+  // the CRC covers the symbols before it as they are on the bus
+  if (_part != pCRC && _part != pAck && _part != pSlaveCRC &&
+      _part != pSlaveAck) {
+    _crc = crc8(_crc, symbol);
+  }
+
+  // An escape sequence is a single byte: ESC 0x00 is ESC, ESC 0x01 is SYN
+  if (_escaped) {
+    _escaped = false;
+    if (symbol > 0x01) {
+      abort();
+      return;
+    }
+    symbol = symbol == 0x00 ? ESC : SYN;
+  } else if (symbol == ESC) {
+    _escaped = true;
+    return;
+  }
+
+  switch (_part) {
+    case pQQ:
+      _qq = symbol;
+      _part = pZZ;
+      break;
+    case pZZ:
+      _zz = symbol;
+      _part = pPB;
+      break;
+    case pPB:
+      _part = pSB;
+      break;
+    case pSB:
+      _part = pNN;
+      break;
+    case pNN:
+      if (symbol > 16) {
+        abort();
+        break;
+      }
+      _nn = _count = symbol;
+      _part = _count > 0 ? pData : pCRC;
+      break;
+    case pData:
+      if (--_count == 0) _part = pCRC;
+      break;
+    case pCRC:
+      if (symbol != _crc) _crcErrors++;
+      if (_zz == BROADCAST) {
+        complete();
+      } else {
+        _part = pAck;
+      }
+      break;
+    case pAck:
+      if (symbol == ACK) {
+        if (BusState::isMaster(_zz)) {
+          complete();
+        } else {
+          _crc = 0;
+          _part = pSlaveNN;
+        }
+      } else if (symbol == NACK) {
+        // the master repeats its part once
+        _naks++;
+        _crc = 0;
+        _part = pQQ;
+      } else {
+        abort();
+      }
+      break;
+    case pSlaveNN:
+      if (symbol > 16) {
+        abort();
+        break;
+      }
+      _count = symbol;
+      _part = _count > 0 ? pSlaveData : pSlaveCRC;
+      break;
+    case pSlaveData:
+      if (--_count == 0) _part = pSlaveCRC;
+      break;
+    case pSlaveCRC:
+      if (symbol != _crc) _slaveCrcErrors++;
+      _part = pSlaveAck;
+      break;
+    case pSlaveAck:
+      if (symbol == ACK) {
+        complete();
+      } else if (symbol == NACK) {
+        // the slave repeats its part once
+        _slaveNaks++;
+        _crc = 0;
+        _part = pSlaveNN;
+      } else {
+        abort();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+int TelegramDecoder::remaining() const {
+  // symbols of the tail after the master CRC: slave response or ACK
+  int tail = _zz == BROADCAST ? 0 : BusState::isMaster(_zz) ? 1 : 4;
+  switch (_part) {
+    case pPB:
+      return 4 + tail;
+    case pSB:
+      return 3 + tail;
+    case pNN:
+      return 2 + tail;
+    case pData:
+      return _count + 1 + tail;
+    case pCRC:
+      return 1 + tail;
+    case pAck:
+      return tail;
+    case pSlaveNN:
+      return 3;
+    case pSlaveData:
+      return _count + 2;
+    case pSlaveCRC:
+      return 2;
+    case pSlaveAck:
+      return 1;
+    case pDone:
+      return 0;
+    default:
+      // idle, or the master address is not yet known
+      return -1;
+  }
+}
+
+void TelegramDecoder::complete() {
+  _telegrams++;
+  if (_zz == BROADCAST) {
+    _broadcast++;
+  } else if (BusState::isMaster(_zz)) {
+    _masterMaster++;
+  } else {
+    _masterSlave++;
+  }
+  _sizes[_nn]++;
+  _sources[_qq]++;
+  _targets[_zz]++;
+  _part = pDone;
+}
+
+void TelegramDecoder::abort() {
+  _aborted++;
+  _part = pIdle;
+}
@@ -0,0 +1,64 @@
+#include "waiter.hpp"
+
+#include <esp_vfs_eventfd.h>
+#include <unistd.h>
+
+bool SocketWaiter::begin() {
+  // fails harmlessly if another module registered eventfd already
+  esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+  esp_vfs_eventfd_register(&config);
+
+  _event = eventfd(0, 0);
+  clear();
+  return _event >= 0;
+}
+
+void SocketWaiter::end() {
+  if (_event >= 0) close(_event);
+  _event = -1;
+}
+
+void SocketWaiter::signal() {
+  if (_event < 0 || !_waiting.exchange(false)) return;
+  uint64_t value = 1;
+  write(_event, &value, sizeof(value));
+}
+
+void SocketWaiter::clear() {
+  FD_ZERO(&_fds);
+  _maxFd = -1;
+}
+
+void SocketWaiter::add(WiFiClient* client) {
+  // a socket closed by the peer stays readable, leave it to the owner
+  if (!client->connected()) return;
+  int fd = client->fd();
+  if (fd < 0) return;
+  FD_SET(fd, &_fds);
+  if (fd > _maxFd) _maxFd = fd;
+}
+
+bool SocketWaiter::wait(uint32_t timeoutMicros, bool (*ready)()) {
+  if (_event >= 0) {
+    FD_SET(_event, &_fds);
+    if (_event > _maxFd) _maxFd = _event;
+  }
+
+  _waiting = true;
+  if (ready && ready()) {
+    _waiting = false;
+    return true;
+  }
+
+  struct timeval timeout;
+  timeout.tv_sec = timeoutMicros / 1000000;
+  timeout.tv_usec = timeoutMicros % 1000000;
+  int res = select(_maxFd + 1, &_fds, nullptr, nullptr, &timeout);
+  _waiting = false;
+
+  if (res > 0 && _event >= 0 && FD_ISSET(_event, &_fds)) {
+    uint64_t value;
+    read(_event, &value, sizeof(value));
+  }
+  return res > 0;
+}
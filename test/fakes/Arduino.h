@@ -0,0 +1,62 @@
+#pragma once
+
+// Just enough of the Arduino core to build the hardware independent modules
+// on the host, see the native environments in platformio.ini. The time is set
+// by the tests.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#define IRAM_ATTR
+
+// FreeRTOS without tasks: nothing is created and the mutexes are always free
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+
+#define portMAX_DELAY 0xffffffffUL
+#define pdTRUE 1
+#define pdPASS 1
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return nullptr; }
+inline int xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+  return pdTRUE;
+}
+inline int xSemaphoreGive(SemaphoreHandle_t mutex) { return pdTRUE; }
+inline int xTaskCreate(void (*task)(void*), const char* name, uint32_t stack,
+                       void* arg, int priority, TaskHandle_t* handle) {
+  return pdPASS;
+}
+inline void vTaskDelay(TickType_t ticks) {}
+inline void vTaskDelete(TaskHandle_t task) {}
+
+extern uint32_t fakeMicros;
+
+inline uint32_t micros() { return fakeMicros; }
+inline uint32_t millis() { return fakeMicros / 1000; }
+
+class String {
+ public:
+  String(const char* str = "") : _str(str) {}
+  const char* c_str() const { return _str.c_str(); }
+  size_t length() const { return _str.size(); }
+  String& operator+=(const char* str) {
+    _str += str;
+    return *this;
+  }
+
+ private:
+  std::string _str;
+};
+
+class HardwareSerial {
+ public:
+  int available() { return 0; }
+  int peek() { return -1; }
+};
+
+extern HardwareSerial Serial1;
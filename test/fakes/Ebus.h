@@ -0,0 +1,148 @@
+#pragma once
+
+// Stand-in for the parts of the ebus library that the host tests build. Only
+// the byte formatting is implemented, the data type conversions return
+// nothing and the bus is never available.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ebus {
+
+enum class DataType {
+  ERROR = -1,
+  BCD,
+  UINT8,
+  INT8,
+  UINT16,
+  INT16,
+  UINT32,
+  INT32,
+  DATA1B,
+  DATA1C,
+  DATA2B,
+  DATA2C,
+  FLOAT,
+  CHAR1,
+  CHAR2,
+  CHAR3,
+  CHAR4,
+  CHAR5,
+  CHAR6,
+  CHAR7,
+  CHAR8,
+  HEX1,
+  HEX2,
+  HEX3,
+  HEX4,
+  HEX5,
+  HEX6,
+  HEX7,
+  HEX8
+};
+
+inline const char* datatype_2_string(DataType type) { return "HEX1"; }
+inline DataType string_2_datatype(const char* str) { return DataType::HEX1; }
+inline size_t sizeof_datatype(DataType type) { return 1; }
+inline bool typeof_datatype(DataType type) { return false; }
+
+inline double round_digits(double value, uint8_t digits) { return value; }
+
+inline double byte_2_bcd(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_uint8(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_int8(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_uint16(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_int16(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_uint32(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_int32(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_data1b(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_data1c(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_data2b(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_data2c(const std::vector<uint8_t>&) { return 0; }
+inline double byte_2_float(const std::vector<uint8_t>&) { return 0; }
+inline std::string byte_2_char(const std::vector<uint8_t>&) { return ""; }
+inline std::string byte_2_hex(const std::vector<uint8_t>&) { return ""; }
+
+inline std::vector<uint8_t> bcd_2_byte(double) { return {}; }
+inline std::vector<uint8_t> uint8_2_byte(double) { return {}; }
+inline std::vector<uint8_t> int8_2_byte(double) { return {}; }
+inline std::vector<uint8_t> uint16_2_byte(double) { return {}; }
+inline std::vector<uint8_t> int16_2_byte(double) { return {}; }
+inline std::vector<uint8_t> uint32_2_byte(double) { return {}; }
+inline std::vector<uint8_t> int32_2_byte(double) { return {}; }
+inline std::vector<uint8_t> data1b_2_byte(double) { return {}; }
+inline std::vector<uint8_t> data1c_2_byte(double) { return {}; }
+inline std::vector<uint8_t> data2b_2_byte(double) { return {}; }
+inline std::vector<uint8_t> data2c_2_byte(double) { return {}; }
+inline std::vector<uint8_t> float_2_byte(double) { return {}; }
+inline std::vector<uint8_t> char_2_byte(const std::string&) { return {}; }
+inline std::vector<uint8_t> hex_2_byte(const std::string&) { return {}; }
+
+inline std::string to_string(const std::vector<uint8_t>& vec) {
+  static const char digits[] = "0123456789abcdef";
+  std::string str;
+  for (uint8_t byte : vec) {
+    str += digits[byte >> 4];
+    str += digits[byte & 0x0f];
+  }
+  return str;
+}
+
+inline std::vector<uint8_t> to_vector(const std::string& str) {
+  std::vector<uint8_t> vec;
+  for (size_t i = 0; i + 1 < str.size(); i += 2)
+    vec.push_back(std::stoul(str.substr(i, 2), nullptr, 16));
+  return vec;
+}
+
+enum class RequestResult {
+  observeSyn,
+  observeData,
+  firstSyn,
+  firstWon,
+  firstRetry,
+  firstLost,
+  firstError,
+  retrySyn,
+  retryError,
+  secondWon,
+  secondLost,
+  secondError
+};
+
+class Request {
+ public:
+  RequestResult getResult() const { return RequestResult::observeSyn; }
+  void setExternalBusRequestedCallback(std::function<void()> callback) {}
+  bool busAvailable() const { return false; }
+  bool requestBus(uint8_t address, bool external = false) { return false; }
+  void reset() {}
+};
+
+// Tests that check what goes to the bus override writeByte
+class Bus {
+ public:
+  virtual ~Bus() {}
+  virtual void writeByte(uint8_t byte) {}
+};
+
+template <typename T>
+class Queue {
+ public:
+  bool try_push(const T& item) { return false; }
+  bool try_pop(T& item) { return false; }
+};
+
+class ServiceRunnerFreeRtos {
+ public:
+  void addByteListener(std::function<void(const uint8_t&)> listener) {}
+};
+
+// Defined by the tests that build the client manager
+extern Bus* bus;
+extern Request* request;
+
+}  // namespace ebus
@@ -0,0 +1,18 @@
+#pragma once
+
+// Non-volatile storage that is always empty on the host
+
+#include <cstddef>
+#include <cstdint>
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false) { return true; }
+  void end() {}
+  size_t getBytesLength(const char* key) { return 0; }
+  size_t getBytes(const char* key, void* buf, size_t maxLen) { return 0; }
+  size_t putBytes(const char* key, const void* value, size_t len) {
+    return len;
+  }
+  bool remove(const char* key) { return true; }
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+// Client connected to the socket fd given by the test, or to nothing. Reads
+// and writes go to the socket without blocking.
+class WiFiClient {
+ public:
+  explicit WiFiClient(int fd = -1) : _fd(fd) {}
+
+  operator bool() { return connected(); }
+  uint8_t connected() { return _fd >= 0; }
+  int available() {
+    int len = 0;
+    return _fd >= 0 && ioctl(_fd, FIONREAD, &len) == 0 ? len : 0;
+  }
+  int read() {
+    uint8_t byte;
+    return read(&byte, 1) == 1 ? byte : -1;
+  }
+  int read(uint8_t* buf, size_t size) {
+    ssize_t len = _fd < 0 ? -1 : recv(_fd, buf, size, MSG_DONTWAIT);
+    return len > 0 ? len : -1;
+  }
+  int peek() {
+    uint8_t byte;
+    ssize_t len = _fd < 0 ? -1 : recv(_fd, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+    return len == 1 ? byte : -1;
+  }
+  size_t write(uint8_t byte) { return write(&byte, 1); }
+  size_t write(const uint8_t* buf, size_t size) {
+    ssize_t len = _fd < 0 ? -1 : send(_fd, buf, size, MSG_DONTWAIT);
+    return len > 0 ? len : 0;
+  }
+  size_t write(const char* str) { return strlen(str); }
+  size_t println(const char* str) { return strlen(str) + 2; }
+  void stop() { _fd = -1; }
+  int fd() const { return _fd; }
+  int setNoDelay(bool nodelay) { return 0; }
+
+ private:
+  int _fd;
+};
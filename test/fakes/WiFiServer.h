@@ -0,0 +1,13 @@
+#pragma once
+
+#include <WiFiClient.h>
+
+// Server without clients
+class WiFiServer {
+ public:
+  explicit WiFiServer(uint16_t port = 80) {}
+
+  void begin() {}
+  bool hasClient() { return false; }
+  WiFiClient accept() { return WiFiClient(); }
+};
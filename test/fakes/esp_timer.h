@@ -0,0 +1,31 @@
+#pragma once
+
+// The timers never fire on the host, tests use a fake ArbitrationClock
+
+#include <cstdint>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef struct esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t*,
+                                  esp_timer_handle_t*) {
+  return ESP_FAIL;
+}
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t) {
+  return ESP_FAIL;
+}
+inline esp_err_t esp_timer_stop(esp_timer_handle_t) { return ESP_FAIL; }
+inline esp_err_t esp_timer_delete(esp_timer_handle_t) { return ESP_FAIL; }
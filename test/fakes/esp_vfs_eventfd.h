@@ -0,0 +1,15 @@
+#pragma once
+
+// The host has eventfd without registering it
+#include <sys/eventfd.h>
+
+typedef struct {
+  size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() \
+  { 5 }
+
+inline int esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config) {
+  return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// lwIP has the BSD socket API of the host
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cerrno>
@@ -0,0 +1,262 @@
+#include <unity.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "bytes.hpp"
+#include "client.hpp"
+#include "eventpool.hpp"
+#include "log.hpp"
+#include "store.hpp"
+
+// Counts the heap allocations of the paths every telegram takes, which must
+// not allocate once their buffers have grown to size.
+
+uint32_t fakeMicros = 0;
+HardwareSerial Serial1;
+
+namespace ebus {
+Bus* bus = nullptr;
+Request* request = nullptr;
+}  // namespace ebus
+
+// The clients of the legacy ports are not run, their bus is a stub
+BusType Bus;
+BusType::BusType() : _client(0), _prearmClient(0) {}
+BusType::~BusType() {}
+void BusType::end() {}
+size_t BusType::write(uint8_t symbol) { return 0; }
+int BusType::available() { return 0; }
+int BusType::availableForWrite() { return 0; }
+size_t BusType::send(uint8_t symbol, uint8_t slot) { return 0; }
+size_t BusType::send(const uint8_t* buffer, size_t size, uint8_t slot) {
+  return 0;
+}
+void clearArbitrationClient(WiFiClient* client) {}
+bool setArbitrationClient(WiFiClient*& client, uint8_t& address) {
+  return false;
+}
+uint8_t clientSlot(const WiFiClient* client) { return NO_CLIENT; }
+void updateLastComms() {}
+
+size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* ptr = malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+// Master 10 08 b5 11 01 xx and slave 02 yy zz of the telegrams
+MasterBytes master;
+SlaveBytes slave;
+
+void makeTelegram(uint8_t value) {
+  const uint8_t masterBytes[] = {0x10, 0x08, 0xb5, 0x11, 0x01, value};
+  const uint8_t slaveBytes[] = {0x02, value, static_cast<uint8_t>(~value)};
+  master.assign(ByteView(masterBytes, sizeof(masterBytes)));
+  slave.assign(ByteView(slaveBytes, sizeof(slaveBytes)));
+}
+
+// What the schedule task does with a passive telegram taken from its event
+// queue: the telegram is formatted for the log on the stack and stored in
+// the matching commands
+void schedulePassive(ByteView master, ByteView slave) {
+  char masterHex[2 * TELEGRAM_MASTER_MAX + 1];
+  char slaveHex[2 * TELEGRAM_SLAVE_MAX + 1];
+  toHex(master, masterHex, sizeof(masterHex));
+  toHex(slave, slaveHex, sizeof(slaveHex));
+
+  char payload[LOG_ENTRY_LEN];
+  snprintf(payload, sizeof(payload), "%s / %s", masterHex, slaveHex);
+
+  store.updateData(nullptr, master, slave);
+  addLog(payload);
+}
+
+Command* masterValue = nullptr;
+Command* slaveValue = nullptr;
+
+void setUp() {
+  Command command;
+  command.key = "master";
+  command.read_cmd = {0x08, 0xb5, 0x11};
+  command.master = true;
+  command.position = 1;
+  command.length = 1;
+  store.insertCommand(command);
+
+  command.key = "slave";
+  command.master = false;
+  command.position = 1;
+  command.length = 2;
+  store.insertCommand(command);
+
+  masterValue = store.findCommand("master");
+  slaveValue = store.findCommand("slave");
+}
+
+void tearDown() {
+  store.removeCommand("master");
+  store.removeCommand("slave");
+}
+
+void test_passive_telegram_does_not_allocate() {
+  // the first telegram sizes the reused buffers
+  makeTelegram(0);
+  schedulePassive(master, slave);
+
+  allocations = 0;
+  for (int i = 1; i <= 1000; i++) {
+    makeTelegram(i);
+    schedulePassive(master, slave);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+
+  TEST_ASSERT_EQUAL_UINT32(1, masterValue->data.size());
+  TEST_ASSERT_EQUAL_HEX8(1000 & 0xff, masterValue->data[0]);
+  TEST_ASSERT_EQUAL_UINT32(2, slaveValue->data.size());
+  TEST_ASSERT_EQUAL_HEX8(1000 & 0xff, slaveValue->data[0]);
+  TEST_ASSERT_EQUAL_HEX8(~1000 & 0xff, slaveValue->data[1]);
+}
+
+void test_found_commands_are_reused() {
+  makeTelegram(0x42);
+  store.updateData(masterValue, master, slave);  // sizes the data
+  const std::vector<Command*>& found = store.findPassiveCommands(master);
+  TEST_ASSERT_EQUAL_UINT32(2, found.size());
+
+  allocations = 0;
+  // the same vector, refilled by the next call
+  const std::vector<Command*>& active =
+      store.updateData(masterValue, master, slave);
+  TEST_ASSERT_EQUAL_PTR(&found, &active);
+  TEST_ASSERT_EQUAL_UINT32(1, active.size());
+  TEST_ASSERT_EQUAL_PTR(masterValue, active[0]);
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+}
+
+// Reads what the client sent to its socket
+size_t receive(int fd, uint8_t* buffer, size_t size) {
+  ssize_t len = recv(fd, buffer, size, MSG_DONTWAIT);
+  return len > 0 ? len : 0;
+}
+
+void test_enhanced_client_writes_do_not_allocate() {
+  int fds[2];
+  TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  WiFiClient socket(fds[0]);
+  EnhancedClient client(&socket, nullptr);
+  ClientByteRing ring;
+  ClientLatency latency;
+  client.resetCursor(ring);
+
+  const uint8_t bytes[] = {0x10, 0x08, 0xb5, 0x11, 0x01, 0x01, 0x89, 0xaa};
+  // started 0x10, then the bytes, those from 0x80 on as received
+  const uint8_t expected[] = {0xc8, 0x90, 0x10, 0x08, 0xc6, 0xb5, 0x11,
+                              0x01, 0x01, 0xc6, 0x89, 0xc6, 0xaa};
+  uint8_t received[64];
+
+  allocations = 0;
+  for (int i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(client.writeCommand(STARTED, 0x10));
+    TEST_ASSERT_TRUE(client.writeBytes(bytes, sizeof(bytes)));
+    // the backlog goes to the socket with the next drain
+    client.drain(ring, latency);
+    TEST_ASSERT_EQUAL_UINT32(0, client.backlog());
+    TEST_ASSERT_EQUAL_UINT32(sizeof(expected),
+                             receive(fds[1], received, sizeof(received)));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, received, sizeof(expected));
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void test_regular_client_writes_do_not_allocate() {
+  int fds[2];
+  TEST_ASSERT_EQUAL_INT(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  WiFiClient socket(fds[0]);
+  RegularClient client(&socket, nullptr);
+  ClientByteRing ring;
+  ClientLatency latency;
+  client.resetCursor(ring);
+
+  const uint8_t bytes[] = {0x10, 0x08, 0xb5, 0x11, 0x01, 0x01, 0x89};
+  uint8_t received[64];
+
+  allocations = 0;
+  for (int i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(client.writeBytes(bytes, sizeof(bytes)));
+    client.drain(ring, latency);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(bytes),
+                             receive(fds[1], received, sizeof(received)));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(bytes, received, sizeof(bytes));
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// A queue of event pointers two deep, like the event queue of the schedule
+struct EventQueue {
+  RingBuffer<int*, 2> ring;
+  bool try_push(int* event) { return ring.push(event); }
+  bool try_pop(int*& event) { return ring.pop(event); }
+};
+
+void test_event_pool_exhaustion() {
+  EventPool<int, 4> pool;
+  EventQueue queue;
+  int* taken[4];
+
+  allocations = 0;
+  // the consumer is stalled, the third event finds the queue full
+  for (int i = 0; i < 3; i++) {
+    taken[i] = pool.take();
+    TEST_ASSERT_NOT_NULL(taken[i]);
+    pool.queue(queue, taken[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, pool.dropped());
+  TEST_ASSERT_EQUAL_UINT32(1, pool.free());
+
+  // the dropped event is the spare and taken first
+  TEST_ASSERT_EQUAL_PTR(taken[2], pool.take());
+  taken[3] = pool.take();
+  TEST_ASSERT_NOT_NULL(taken[3]);
+
+  // the consumer holds both queued events, nothing is left to take
+  int* held[2];
+  TEST_ASSERT_TRUE(queue.try_pop(held[0]));
+  TEST_ASSERT_TRUE(queue.try_pop(held[1]));
+  TEST_ASSERT_NULL(pool.take());
+  TEST_ASSERT_EQUAL_UINT32(1, pool.exhausted());
+
+  // every event returns to the pool
+  pool.give(held[0]);
+  pool.give(held[1]);
+  pool.give(taken[2]);
+  pool.give(taken[3]);
+  TEST_ASSERT_EQUAL_UINT32(4, pool.free());
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_passive_telegram_does_not_allocate);
+  RUN_TEST(test_found_commands_are_reused);
+  RUN_TEST(test_enhanced_client_writes_do_not_allocate);
+  RUN_TEST(test_regular_client_writes_do_not_allocate);
+  RUN_TEST(test_event_pool_exhaustion);
+  return UNITY_END();
+}
@@ -0,0 +1,581 @@
+#include <unity.h>
+
+#include <cstdio>
+
+#include "arbitration.hpp"
+#include "bus.hpp"
+
+// Bus traces replayed through BusState and the arbitration. The clock is
+// fake, so the master address is "sent" when the test advances the time past
+// the instant the arbitration asked for.
+
+uint32_t fakeMicros = 0;
+HardwareSerial Serial1;
+
+// Symbols written to the bus by the arbitration
+uint8_t written[8];
+uint32_t writtenAt[8];
+size_t writes = 0;
+
+BusType Bus;
+BusType::BusType() : _client(0), _prearmClient(0) {}
+BusType::~BusType() {}
+void BusType::end() {}
+size_t BusType::write(uint8_t symbol) {
+  if (writes < sizeof(written)) {
+    written[writes] = symbol;
+    writtenAt[writes] = fakeMicros;
+  }
+  writes++;
+  return 1;
+}
+int BusType::available() { return 0; }
+
+class FakeClock : public ArbitrationClock {
+ public:
+  uint32_t cancels = 0;
+
+  uint32_t now() override { return fakeMicros; }
+
+  void once(uint32_t delay, void (*fn)(void*), void* arg) override {
+    if (delay == 0) {
+      fn(arg);
+      return;
+    }
+    _fn = fn;
+    _arg = arg;
+    _due = fakeMicros + delay;
+  }
+
+  void cancel() override {
+    cancels++;
+    _fn = nullptr;
+  }
+
+  // Let the time pass, calling the pending function when it is due
+  void advanceTo(uint32_t time) {
+    if (_fn && static_cast<int32_t>(time - _due) >= 0) {
+      fakeMicros = _due;
+      void (*fn)(void*) = _fn;
+      _fn = nullptr;
+      fn(_arg);
+    }
+    fakeMicros = time;
+  }
+
+ private:
+  void (*_fn)(void*) = nullptr;
+  void* _arg = nullptr;
+  uint32_t _due = 0;
+};
+
+const uint32_t SYMBOL = BusState::SYMBOL_MICROS;
+
+// Start bit of the last SYN
+uint32_t synStart = 0;
+
+// Feeds the symbols one symbol time apart
+void replay(BusState& state, const uint8_t* symbols, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    fakeMicros += SYMBOL;
+    state.data(symbols[i], fakeMicros);
+  }
+}
+
+// Two SYNs take the bus state out of startup
+const uint8_t STARTUP[] = {SYN, SYN};
+
+// Master slave telegram 10 08 b5 11 01 01 with a one byte response
+const uint8_t MASTER_SLAVE[] = {SYN,  0x10, 0x08, 0xb5, 0x11, 0x01, 0x01,
+                                0x89, ACK,  0x01, 0x55, 0xce, ACK};
+
+// The SYN that started at synStart is complete and read by the serial task
+// readMicros after its start bit
+void readSyn(Arbitration& arbitration, BusState& state, FakeClock& clock,
+             uint32_t readMicros) {
+  clock.advanceTo(synStart + readMicros);
+  state.data(SYN, synStart);
+  TEST_ASSERT_EQUAL(Arbitration::none,
+                    arbitration.data(state, SYN, synStart));
+}
+
+// The next symbol is a SYN, read readMicros after its start bit
+void receiveSyn(Arbitration& arbitration, BusState& state, FakeClock& clock,
+                uint32_t readMicros) {
+  fakeMicros += SYMBOL;
+  synStart = fakeMicros;
+  readSyn(arbitration, state, clock, readMicros);
+}
+
+// The serial task is woken by the start bit of the SYN after a telegram and
+// prearms master
+void prearmAfterTelegram(Arbitration& arbitration, BusState& state,
+                         uint8_t master) {
+  replay(state, MASTER_SLAVE, sizeof(MASTER_SLAVE));
+  TEST_ASSERT_TRUE(state.telegramComplete());
+  fakeMicros += SYMBOL;
+  synStart = fakeMicros;
+  fakeMicros += 50;
+  TEST_ASSERT_TRUE(arbitration.prearm(state, master, synStart));
+}
+
+void setUp() {
+  fakeMicros = 1000000;
+  writes = 0;
+}
+
+void tearDown() {}
+
+void test_send_delay() {
+  // handed to the uart its latency before the window opens
+  TEST_ASSERT_EQUAL_INT32(Arbitration::WINDOW_BEGIN - 1000 - 700,
+                          Arbitration::sendDelay(5000, 6000, 700));
+  // across the wrap around of micros
+  TEST_ASSERT_EQUAL_INT32(Arbitration::WINDOW_BEGIN - 2000 - 700,
+                          Arbitration::sendDelay(0xfffffc18, 1000, 700));
+  // negative once the instant has passed
+  TEST_ASSERT_EQUAL_INT32(-667, Arbitration::sendDelay(0, SYMBOL + 100, 700));
+}
+
+void test_start_waits_for_the_window() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  receiveSyn(arbitration, state, clock, 1000);
+
+  TEST_ASSERT_EQUAL(Arbitration::started,
+                    arbitration.start(state, 0x31, synStart));
+  TEST_ASSERT_EQUAL_UINT32(0, writes);
+  clock.advanceTo(synStart + Arbitration::WINDOW_END);
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  TEST_ASSERT_EQUAL_HEX8(0x31, written[0]);
+  TEST_ASSERT_EQUAL_UINT32(
+      synStart + Arbitration::WINDOW_BEGIN - Arbitration::UART_LATENCY,
+      writtenAt[0]);
+}
+
+void test_start_after_send_instant_writes_at_once() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  receiveSyn(arbitration, state, clock, SYMBOL + 100);
+
+  TEST_ASSERT_EQUAL(Arbitration::started,
+                    arbitration.start(state, 0x31, synStart));
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  TEST_ASSERT_EQUAL_UINT32(synStart + SYMBOL + 100, writtenAt[0]);
+
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x31, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::won1,
+                    arbitration.data(state, 0x31, fakeMicros));
+}
+
+// The rest of a telegram of ours after the master address
+const uint8_t TELEGRAM[] = {0x08, 0xb5, 0x11, 0x01, 0x01, 0x89, 0x00,
+                            0x01, 0x55, 0xce, 0x00};
+
+void test_send_instant_is_learned_from_echo() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  // the uart is much faster than the initial estimate
+  const uint32_t uart = 30;
+  uint32_t echoes[64];
+  for (int i = 0; i < 64; i++) {
+    writes = 0;
+    receiveSyn(arbitration, state, clock, SYMBOL + 100);
+    TEST_ASSERT_EQUAL(Arbitration::started,
+                      arbitration.start(state, 0x31, synStart));
+    clock.advanceTo(synStart + Arbitration::WINDOW_END);
+    TEST_ASSERT_EQUAL_UINT32(1, writes);
+    uint32_t echoStart = writtenAt[0] + uart;
+    echoes[i] = echoStart - synStart;
+    fakeMicros = echoStart;
+    state.data(0x31, fakeMicros);
+    TEST_ASSERT_EQUAL(Arbitration::won1,
+                      arbitration.data(state, 0x31, echoStart));
+    replay(state, TELEGRAM, sizeof(TELEGRAM));
+  }
+  // sent as soon as the SYN was read, which is too early for this uart
+  TEST_ASSERT_EQUAL_UINT32(SYMBOL + 100 + uart, echoes[0]);
+  // then the estimate approaches the uart latency and the address is handed
+  // over later, until it arrives in the window
+  TEST_ASSERT_GREATER_OR_EQUAL_INT32(uart, arbitration.latency());
+  TEST_ASSERT_LESS_OR_EQUAL_INT32(uart + 16, arbitration.latency());
+  for (int i = 40; i < 64; i++) {
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(Arbitration::WINDOW_BEGIN, echoes[i]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(Arbitration::WINDOW_END, echoes[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(64, arbitration.echoes());
+  TEST_ASSERT_GREATER_THAN_UINT32(16, arbitration.windowHits());
+}
+
+void test_lost_and_late_echoes_are_learned() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  // read so late that the address reaches the bus after the window
+  receiveSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_EQUAL(Arbitration::started,
+                    arbitration.start(state, 0x31, synStart));
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+
+  // 0x10 wins, its start bit is the one of our address
+  fakeMicros = writtenAt[0] + 400;
+  state.data(0x10, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::arbitrating,
+                    arbitration.data(state, 0x10, fakeMicros));
+  fakeMicros += SYMBOL;
+  state.data(0x08, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::lost1,
+                    arbitration.data(state, 0x08, fakeMicros));
+
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.echoes());
+  TEST_ASSERT_EQUAL_UINT32(0, arbitration.windowHits());
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.latencySamples());
+  TEST_ASSERT_LESS_OR_EQUAL_INT32(Arbitration::UART_LATENCY - 1,
+                                  arbitration.latency());
+}
+
+void test_start_after_window_is_late() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  receiveSyn(arbitration, state, clock, Arbitration::WINDOW_END + 1);
+
+  TEST_ASSERT_EQUAL(Arbitration::late,
+                    arbitration.start(state, 0x31, synStart));
+  clock.advanceTo(synStart + 2 * Arbitration::WINDOW_END);
+  TEST_ASSERT_EQUAL_UINT32(0, writes);
+}
+
+void test_second_round_is_scheduled_from_second_syn() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  receiveSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_EQUAL(Arbitration::started,
+                    arbitration.start(state, 0x31, synStart));
+  TEST_ASSERT_EQUAL_HEX8(0x31, written[0]);
+
+  // 0x11 of the same priority class wins the first round
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x11, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::arbitrating,
+                    arbitration.data(state, 0x11, fakeMicros));
+
+  // so the address is sent again after the second SYN
+  fakeMicros += SYMBOL;
+  synStart = fakeMicros;
+  fakeMicros += SYMBOL + 50;
+  state.data(SYN, synStart);
+  TEST_ASSERT_EQUAL(Arbitration::arbitrating,
+                    arbitration.data(state, SYN, synStart));
+  clock.advanceTo(synStart + Arbitration::WINDOW_END);
+  TEST_ASSERT_EQUAL_UINT32(2, writes);
+  TEST_ASSERT_EQUAL_HEX8(0x31, written[1]);
+  // the latency of the uart is too long to wait any further
+  TEST_ASSERT_EQUAL_UINT32(synStart + SYMBOL + 50, writtenAt[1]);
+
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x31, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::won2,
+                    arbitration.data(state, 0x31, fakeMicros));
+}
+
+void test_master_slave_telegram() {
+  BusState state;
+  replay(state, STARTUP, 2);
+  // symbols still to come after each symbol, -1 if not followed
+  const int remaining[] = {-1, -1, 8, 7, 6, 6, 5, 4, 3, 3, 2, 1, 0};
+  for (size_t i = 0; i < sizeof(MASTER_SLAVE); i++) {
+    replay(state, &MASTER_SLAVE[i], 1);
+    TEST_ASSERT_EQUAL_INT(remaining[i], state.telegramRemaining());
+    TEST_ASSERT_EQUAL(i == sizeof(MASTER_SLAVE) - 1,
+                      state.telegramComplete());
+  }
+  replay(state, MASTER_SLAVE, 1);
+  TEST_ASSERT_EQUAL(BusState::eReceivedFirstSYN, state._state);
+}
+
+void test_broadcast_and_master_master() {
+  BusState state;
+  replay(state, STARTUP, 2);
+  // the escape sequence a9 01 is a single data byte
+  const uint8_t broadcast[] = {SYN, 0x10, BROADCAST, 0x07, 0x00, 0x02,
+                               ESC, 0x01, 0x33,      0x4c};
+  replay(state, broadcast, sizeof(broadcast) - 1);
+  TEST_ASSERT_EQUAL_INT(1, state.telegramRemaining());
+  replay(state, &broadcast[sizeof(broadcast) - 1], 1);
+  TEST_ASSERT_TRUE(state.telegramComplete());
+
+  const uint8_t masterMaster[] = {SYN, 0x10, 0x30, 0x07, 0x04,
+                                  0x00, 0x9a, ACK};
+  replay(state, masterMaster, sizeof(masterMaster) - 1);
+  TEST_ASSERT_EQUAL_INT(1, state.telegramRemaining());
+  replay(state, &masterMaster[sizeof(masterMaster) - 1], 1);
+  TEST_ASSERT_TRUE(state.telegramComplete());
+}
+
+void test_nack_is_not_followed() {
+  BusState state;
+  replay(state, STARTUP, 2);
+  const uint8_t nack[] = {SYN, 0x10, 0x08, 0xb5, 0x11, 0x00, 0x3c, NACK};
+  replay(state, nack, sizeof(nack));
+  TEST_ASSERT_EQUAL_INT(-1, state.telegramRemaining());
+  TEST_ASSERT_FALSE(state.telegramComplete());
+}
+
+void test_prearm_confirmed() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  prearmAfterTelegram(arbitration, state, 0x31);
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.prearms());
+
+  readSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  TEST_ASSERT_EQUAL_HEX8(0x31, written[0]);
+  TEST_ASSERT_EQUAL_UINT32(
+      synStart + Arbitration::WINDOW_BEGIN - Arbitration::UART_LATENCY,
+      writtenAt[0]);
+  TEST_ASSERT_EQUAL(Arbitration::confirmed,
+                    arbitration.confirm(state, true, 0x31, synStart));
+  // start finds the arbitration running already
+  TEST_ASSERT_EQUAL(Arbitration::not_started,
+                    arbitration.start(state, 0x31, synStart));
+
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x31, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::won1,
+                    arbitration.data(state, 0x31, fakeMicros));
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  TEST_ASSERT_EQUAL_UINT32(0, arbitration.prearmMisses());
+}
+
+void test_prearm_miss_is_followed_as_orphan() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  prearmAfterTelegram(arbitration, state, 0x31);
+
+  // a master sends without the SYN, which is only read after the timer sent
+  // the address over it
+  clock.advanceTo(synStart + SYMBOL + 100);
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  state.data(0x10, synStart);
+  TEST_ASSERT_EQUAL(Arbitration::none,
+                    arbitration.data(state, 0x10, synStart));
+  TEST_ASSERT_EQUAL(Arbitration::orphaned,
+                    arbitration.confirm(state, true, 0x31, synStart));
+  TEST_ASSERT_EQUAL_UINT32(0, clock.cancels);
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.prearmMisses());
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.prearmOrphans());
+
+  fakeMicros += SYMBOL;
+  state.data(0x08, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::lost1,
+                    arbitration.data(state, 0x08, fakeMicros));
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+}
+
+void test_prearm_withdrawn_by_client() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  prearmAfterTelegram(arbitration, state, 0x31);
+
+  TEST_ASSERT_TRUE(arbitration.withdraw());
+  TEST_ASSERT_EQUAL_UINT32(1, clock.cancels);
+  readSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_EQUAL_UINT32(0, writes);
+  TEST_ASSERT_EQUAL(Arbitration::withdrawn,
+                    arbitration.confirm(state, false, SYN, synStart));
+  TEST_ASSERT_EQUAL_UINT32(0, arbitration.prearmOrphans());
+
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x10, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::none,
+                    arbitration.data(state, 0x10, fakeMicros));
+}
+
+void test_prearm_sent_for_other_address_is_orphaned() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  prearmAfterTelegram(arbitration, state, 0x31);
+
+  readSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+  TEST_ASSERT_EQUAL(Arbitration::orphaned,
+                    arbitration.confirm(state, true, 0x33, synStart));
+  TEST_ASSERT_EQUAL_UINT32(0, arbitration.prearmMisses());
+  TEST_ASSERT_EQUAL_UINT32(1, arbitration.prearmOrphans());
+
+  // no second address for the new request
+  TEST_ASSERT_EQUAL(Arbitration::not_started,
+                    arbitration.start(state, 0x33, synStart));
+  clock.advanceTo(synStart + Arbitration::WINDOW_END);
+  TEST_ASSERT_EQUAL_UINT32(1, writes);
+
+  // the orphan is followed until it is won
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x31, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::won1,
+                    arbitration.data(state, 0x31, fakeMicros));
+}
+
+void test_prearm_withdrawn_too_late_is_followed_to_lost() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  prearmAfterTelegram(arbitration, state, 0x31);
+
+  readSyn(arbitration, state, clock, SYMBOL + 100);
+  TEST_ASSERT_FALSE(arbitration.withdraw());
+  TEST_ASSERT_EQUAL_UINT32(0, clock.cancels);
+  TEST_ASSERT_EQUAL(Arbitration::orphaned,
+                    arbitration.confirm(state, false, SYN, synStart));
+
+  fakeMicros = synStart + Arbitration::WINDOW_BEGIN;
+  state.data(0x10, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::arbitrating,
+                    arbitration.data(state, 0x10, fakeMicros));
+  fakeMicros += SYMBOL;
+  state.data(0x08, fakeMicros);
+  TEST_ASSERT_EQUAL(Arbitration::lost1,
+                    arbitration.data(state, 0x08, fakeMicros));
+}
+
+void test_prearm_needs_complete_telegram() {
+  FakeClock clock;
+  Arbitration arbitration(&clock);
+  BusState state;
+  replay(state, STARTUP, 2);
+  replay(state, MASTER_SLAVE, sizeof(MASTER_SLAVE) - 1);
+  fakeMicros += SYMBOL;
+  TEST_ASSERT_FALSE(arbitration.prearm(state, 0x31, fakeMicros));
+
+  // nor on an edge of the last symbol of the telegram
+  replay(state, &MASTER_SLAVE[sizeof(MASTER_SLAVE) - 1], 1);
+  TEST_ASSERT_EQUAL_UINT32(fakeMicros + SYMBOL, state.expectedFree());
+  TEST_ASSERT_FALSE(arbitration.prearm(state, 0x31, fakeMicros + 100));
+
+  // nor when the start bit is too old to reach the window
+  fakeMicros += SYMBOL;
+  synStart = fakeMicros;
+  fakeMicros += Arbitration::WINDOW_BEGIN - Arbitration::UART_LATENCY;
+  TEST_ASSERT_FALSE(arbitration.prearm(state, 0x31, synStart));
+  TEST_ASSERT_EQUAL_UINT32(0, arbitration.prearms());
+  TEST_ASSERT_EQUAL_UINT32(0, writes);
+}
+
+// Recorded bus traffic: a master slave telegram, a broadcast, a master
+// master telegram, a telegram repeated after a NACK and the SYNs of an idle
+// bus, each telegram starting with the SYN that freed the bus before it
+const uint8_t TRACE[] = {
+    SYN,  0x10, 0x08, 0xb5, 0x11, 0x01, 0x01, 0x89, ACK,  0x01, 0x55, 0xce,
+    ACK,  SYN,  0x10, 0xfe, 0x07, 0x00, 0x02, ESC,  0x01, 0x33, 0x4c, SYN,
+    0x10, 0x30, 0x07, 0x04, 0x00, 0x9a, ACK,  SYN,  0x10, 0x08, 0xb5, 0x11,
+    0x00, 0x3c, NACK, 0x10, 0x08, 0xb5, 0x11, 0x00, 0x3c, ACK,  0x01, 0x55,
+    0xce, ACK,  SYN,  SYN,  SYN};
+
+// Time the serial task needs to read a SYN after its last bit, by its load
+const uint32_t LOAD[] = {20, 80, 150, 300, 600, 1200};
+
+struct Attempts {
+  uint32_t syns = 0;
+  uint32_t late = 0;  // address not on the bus by the end of the window
+};
+
+// Replays TRACE rounds times and tries a fresh arbitration for 0x31 on every
+// SYN that frees the bus. If prearm is set it is prearmed on the start bit of
+// the SYN when the telegram before allows it, otherwise it is started when
+// the SYN is read.
+Attempts arbitrateOnTrace(bool prearm, int rounds) {
+  Attempts attempts;
+  BusState state;
+  size_t load = 0;
+  replay(state, STARTUP, 2);
+  for (int round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < sizeof(TRACE); i++) {
+      if (TRACE[i] != SYN) {
+        replay(state, &TRACE[i], 1);
+        continue;
+      }
+      FakeClock clock;
+      Arbitration arbitration(&clock);
+      writes = 0;
+      fakeMicros += SYMBOL;
+      uint32_t startBit = fakeMicros;
+      fakeMicros += 50;
+      bool prearmed = prearm && arbitration.prearm(state, 0x31, startBit);
+      clock.advanceTo(startBit + SYMBOL + LOAD[load++ % 6]);
+      state.data(SYN, startBit);
+      attempts.syns++;
+      if (prearmed) {
+        arbitration.confirm(state, true, 0x31, startBit);
+      } else if (arbitration.start(state, 0x31, startBit) !=
+                 Arbitration::started) {
+        attempts.late++;
+        continue;
+      }
+      clock.advanceTo(fakeMicros + Arbitration::WINDOW_END);
+      if (writes == 0 || writtenAt[0] + arbitration.latency() - startBit >
+                             static_cast<uint32_t>(Arbitration::WINDOW_END))
+        attempts.late++;
+    }
+  }
+  return attempts;
+}
+
+void test_prearm_reduces_late_arbitrations() {
+  Attempts started = arbitrateOnTrace(false, 6);
+  Attempts prearmed = arbitrateOnTrace(true, 6);
+  TEST_ASSERT_EQUAL_UINT32(started.syns, prearmed.syns);
+  // only the SYNs of the idle bus are still late
+  TEST_ASSERT_EQUAL_UINT32(started.syns, started.late);
+  TEST_ASSERT_EQUAL_UINT32(6 * 3, prearmed.late);
+
+  char line[96];
+  snprintf(line, sizeof(line),
+           "%u SYNs: %u late without prearm, %u late with prearm",
+           static_cast<unsigned>(started.syns),
+           static_cast<unsigned>(started.late),
+           static_cast<unsigned>(prearmed.late));
+  TEST_MESSAGE(line);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_master_slave_telegram);
+  RUN_TEST(test_broadcast_and_master_master);
+  RUN_TEST(test_nack_is_not_followed);
+  RUN_TEST(test_send_delay);
+  RUN_TEST(test_start_waits_for_the_window);
+  RUN_TEST(test_start_after_send_instant_writes_at_once);
+  RUN_TEST(test_send_instant_is_learned_from_echo);
+  RUN_TEST(test_lost_and_late_echoes_are_learned);
+  RUN_TEST(test_start_after_window_is_late);
+  RUN_TEST(test_second_round_is_scheduled_from_second_syn);
+  RUN_TEST(test_prearm_confirmed);
+  RUN_TEST(test_prearm_miss_is_followed_as_orphan);
+  RUN_TEST(test_prearm_withdrawn_by_client);
+  RUN_TEST(test_prearm_sent_for_other_address_is_orphaned);
+  RUN_TEST(test_prearm_withdrawn_too_late_is_followed_to_lost);
+  RUN_TEST(test_prearm_needs_complete_telegram);
+  RUN_TEST(test_prearm_reduces_late_arbitrations);
+  return UNITY_END();
+}
@@ -0,0 +1,116 @@
+#include <unity.h>
+
+#include <cstring>
+
+#include "broadcast.hpp"
+
+// Readers of the broadcast ring whose sockets take only part of the bytes.
+// Records are encoded to pairs like the enhanced protocol, the stream must
+// stay in sync on pair boundaries.
+
+typedef BroadcastRing<uint8_t, 8> Ring;
+
+const uint8_t MARKER[] = {0xee, 0xee};
+
+size_t encodePair(uint8_t value, uint8_t* out) {
+  out[0] = 0xc0 | value >> 6;
+  out[1] = 0x80 | (value & 0x3f);
+  return 2;
+}
+
+// What the socket of the reader took so far, at most limit bytes per write
+uint8_t output[256];
+size_t outputLen = 0;
+size_t limit = 0;
+
+int drain(const Ring& ring, Ring::Cursor& cursor) {
+  return ring.drain(cursor, MARKER, sizeof(MARKER), encodePair,
+                    [](const uint8_t* data, size_t len) {
+                      if (len > limit) len = limit;
+                      memcpy(output + outputLen, data, len);
+                      outputLen += len;
+                      return static_cast<int>(len);
+                    });
+}
+
+void setUp() {
+  outputLen = 0;
+  limit = BROADCAST_CHUNK;
+}
+
+void tearDown() {}
+
+void test_partial_writes_keep_pairs() {
+  Ring ring;
+  Ring::Cursor cursor;
+  ring.reset(cursor);
+  for (uint8_t value = 0; value < 5; value++) ring.push(value * 50, 0);
+
+  limit = 3;
+  while (ring.unread(cursor)) TEST_ASSERT_TRUE(drain(ring, cursor) > 0);
+
+  TEST_ASSERT_EQUAL(10, outputLen);
+  for (uint8_t value = 0; value < 5; value++) {
+    uint8_t pair[2];
+    encodePair(value * 50, pair);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(pair, output + 2 * value, 2);
+  }
+}
+
+void test_overrun_resyncs_on_pair_boundary() {
+  Ring ring;
+  Ring::Cursor cursor;
+  ring.reset(cursor);
+  ring.push(0x81, 0);
+
+  // the socket takes the first byte of the pair only
+  limit = 1;
+  TEST_ASSERT_EQUAL(1, drain(ring, cursor));
+
+  // the reader falls behind by more than the ring
+  for (uint8_t value = 0; value < 2 * Ring::capacity(); value++)
+    ring.push(value, 0);
+  limit = BROADCAST_CHUNK;
+  TEST_ASSERT_TRUE(drain(ring, cursor) > 0);
+  TEST_ASSERT_FALSE(ring.unread(cursor));
+  TEST_ASSERT_EQUAL_UINT32(Ring::capacity(), cursor.dropped);
+
+  // the rest of the pair, the marker and the records still in the ring
+  uint8_t pair[2];
+  encodePair(0x81, pair);
+  TEST_ASSERT_EQUAL(2 + 2 + 2 * Ring::capacity(), outputLen);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(pair, output, 2);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(MARKER, output + 2, 2);
+  for (size_t i = 0; i < Ring::capacity(); i++) {
+    encodePair(Ring::capacity() + i, pair);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(pair, output + 4 + 2 * i, 2);
+  }
+}
+
+void test_marker_taken_in_part() {
+  Ring ring;
+  Ring::Cursor cursor;
+  ring.reset(cursor);
+  for (uint8_t value = 0; value < Ring::capacity() + 1; value++)
+    ring.push(value, 0);
+
+  limit = 1;
+  TEST_ASSERT_EQUAL(1, drain(ring, cursor));
+  TEST_ASSERT_FALSE(cursor.overrun);
+  limit = BROADCAST_CHUNK;
+  drain(ring, cursor);
+
+  TEST_ASSERT_EQUAL(2 + 2 * Ring::capacity(), outputLen);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(MARKER, output, 2);
+  uint8_t pair[2];
+  encodePair(1, pair);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(pair, output + 2, 2);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_partial_writes_keep_pairs);
+  RUN_TEST(test_overrun_resyncs_on_pair_boundary);
+  RUN_TEST(test_marker_taken_in_part);
+  return UNITY_END();
+}
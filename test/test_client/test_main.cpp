@@ -0,0 +1,468 @@
+#include <unity.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "client.hpp"
+
+// The backlog of a client whose socket takes only part of the bytes, the
+// transmit continuation between the task and the byte listener, the order in
+// which the policies give clients the bus and the filters of read-only
+// clients
+
+uint32_t fakeMicros = 0;
+HardwareSerial Serial1;
+
+// The clients of the legacy ports are not run, their bus is a stub
+BusType Bus;
+BusType::BusType() : _client(0), _prearmClient(0) {}
+BusType::~BusType() {}
+void BusType::end() {}
+size_t BusType::write(uint8_t symbol) { return 0; }
+int BusType::available() { return 0; }
+int BusType::availableForWrite() { return 0; }
+size_t BusType::send(uint8_t symbol, uint8_t slot) { return 0; }
+size_t BusType::send(const uint8_t* buffer, size_t size, uint8_t slot) {
+  return 0;
+}
+void clearArbitrationClient(WiFiClient* client) {}
+bool setArbitrationClient(WiFiClient*& client, uint8_t& address) {
+  return false;
+}
+uint8_t clientSlot(const WiFiClient* client) { return NO_CLIENT; }
+void updateLastComms() {}
+
+// Bus whose echoes are replayed by the byte listener of the tests
+struct EchoBus : ebus::Bus {
+  uint8_t written[4096];
+  std::atomic<size_t> writtenLen{0};
+  RingBuffer<uint8_t, 256> echoes;
+
+  void writeByte(uint8_t byte) override {
+    // the task and the listener never write at the same time
+    written[writtenLen] = byte;
+    writtenLen++;
+    echoes.push(byte);
+  }
+};
+
+EchoBus echoBus;
+
+namespace ebus {
+Bus* bus = &echoBus;
+Request* request = nullptr;
+}  // namespace ebus
+
+// The socket of the clients. It takes at most limit bytes per write, none if
+// it is full and fails the connection if limit is negative.
+const int SOCKET = 100;
+uint8_t output[1024];
+size_t outputLen = 0;
+int limit = 0;
+
+ssize_t send(int fd, const void* data, size_t len, int flags) {
+  if (limit <= 0) {
+    errno = limit < 0 ? ECONNRESET : EAGAIN;
+    return -1;
+  }
+  if (len > static_cast<size_t>(limit)) len = limit;
+  memcpy(output + outputLen, data, len);
+  outputLen += len;
+  return len;
+}
+
+struct ClientManagerTest {
+  static void armTransmit() { clientManager.transmitArmed = true; }
+  static bool queueByte(uint8_t byte) {
+    return clientManager.transmitQueue.push(byte);
+  }
+  static bool waitsForEcho() {
+    return clientManager.transmitState == ClientManager::transmitEcho;
+  }
+  static bool transmitIdle() {
+    return clientManager.transmitState == ClientManager::transmitIdle &&
+           clientManager.transmitQueue.empty();
+  }
+  static void onBusByte(uint8_t byte) { clientManager.onBusByte(byte, 0); }
+  static void continueTransmit() { clientManager.continueTransmit(); }
+  static void endTransmit() { clientManager.endTransmit(); }
+
+  static void addClient(AbstractClient* client) {
+    clientManager.clients.emplace_back(client);
+  }
+  static size_t clients() { return clientManager.clients.size(); }
+  static void removeDisconnected() { clientManager.acceptClients(); }
+  static uint32_t overflowDisconnects() {
+    return clientManager.overflowDisconnects;
+  }
+
+  // Index of the client that gets the bus next, -1 if none has data
+  static int select() {
+    AbstractClient* selected = clientManager.selectClient();
+    for (size_t i = 0; i < clientManager.clients.size(); ++i) {
+      if (clientManager.clients[i].get() == selected) return i;
+    }
+    return -1;
+  }
+  static AbstractClient* client(size_t i) {
+    return clientManager.clients[i].get();
+  }
+  // Gives a client a filter as if it had sent the spec
+  static void setFilter(AbstractClient* client, const FilterSpec& spec) {
+    client->filter.spec = spec;
+    client->filter.active = true;
+    clientManager.filtersChanged = true;
+    clientManager.updateFilters();
+  }
+  static void updateFilters() { clientManager.updateFilters(); }
+  static void filterBytes(const uint8_t* bytes, size_t len) {
+    for (size_t i = 0; i < len; i++) clientManager.filterByte(bytes[i]);
+  }
+  static uint32_t filterOverflows() { return clientManager.filterOverflows; }
+
+  static void removeClients() {
+    clientManager.clients.clear();
+    clientManager.nextClient = 0;
+    clientManager.setPolicy(CLIENT_POLICY);
+  }
+};
+
+typedef ClientManagerTest Manager;
+
+// Regular clients with a byte for the bus, except for the last one
+const size_t CLIENTS = 4;
+WiFiClient sockets[CLIENTS];
+int ends[CLIENTS][2];
+bool pending = false;
+
+void addPendingClients(const int32_t weights[CLIENTS]) {
+  for (size_t i = 0; i < CLIENTS; i++) {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, ends[i]);
+    sockets[i] = WiFiClient(ends[i][0]);
+    if (i < CLIENTS - 1) write(ends[i][1], "\x10", 1);
+    AbstractClient* client = new RegularClient(&sockets[i], nullptr);
+    client->access.weight = weights[i];
+    Manager::addClient(client);
+  }
+  pending = true;
+}
+
+void removePendingClients() {
+  Manager::removeClients();
+  if (!pending) return;
+  for (size_t i = 0; i < CLIENTS; i++) {
+    close(ends[i][0]);
+    close(ends[i][1]);
+  }
+  pending = false;
+}
+
+void setUp() {
+  outputLen = 0;
+  limit = 0;
+  echoBus.writtenLen = 0;
+  uint8_t echo;
+  while (echoBus.echoes.pop(echo)) {
+  }
+}
+
+void tearDown() {
+  Manager::endTransmit();
+  removePendingClients();
+}
+
+void test_backlog_partial_writes() {
+  WiFiClient socket(SOCKET);
+  RegularClient client(&socket, nullptr);
+  ClientByteRing ring;
+  ClientLatency latency;
+  client.resetCursor(ring);
+
+  const uint8_t bytes[] = {0x10, 0x08, 0xb5, 0x11, 0x01,
+                           0x01, 0x89, 0x00, 0x01, 0x55};
+  TEST_ASSERT_TRUE(client.writeBytes(bytes, sizeof(bytes)));
+  ring.push({0x42, nullptr}, 0);
+
+  // the socket is full, everything waits
+  client.drain(ring, latency);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(bytes), client.backlog());
+  TEST_ASSERT_EQUAL_UINT32(0, outputLen);
+  TEST_ASSERT_TRUE(client.behind(ring));
+
+  // the ring waits until the backlog is flushed
+  limit = 3;
+  for (int left = sizeof(bytes) - 3; left > 0; left -= 3) {
+    client.drain(ring, latency);
+    TEST_ASSERT_EQUAL_UINT32(left, client.backlog());
+    TEST_ASSERT_TRUE(client.behind(ring));
+  }
+  client.drain(ring, latency);
+  TEST_ASSERT_EQUAL_UINT32(0, client.backlog());
+  TEST_ASSERT_FALSE(client.behind(ring));
+  TEST_ASSERT_TRUE(client.isConnected());
+
+  TEST_ASSERT_EQUAL_UINT32(sizeof(bytes) + 1, outputLen);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(bytes, output, sizeof(bytes));
+  TEST_ASSERT_EQUAL_HEX8(0x42, output[sizeof(bytes)]);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(bytes), client.backlogMax());
+}
+
+void test_backlog_overflow_disconnects() {
+  WiFiClient socket(SOCKET);
+  RegularClient* client = new RegularClient(&socket, nullptr);
+  Manager::addClient(client);
+
+  uint8_t bytes[CLIENT_BACKLOG_SIZE] = {};
+  TEST_ASSERT_TRUE(client->writeBytes(bytes, sizeof(bytes)));
+  TEST_ASSERT_FALSE(client->overflowed());
+  TEST_ASSERT_FALSE(client->writeBytes(bytes, 1));
+  TEST_ASSERT_TRUE(client->overflowed());
+  TEST_ASSERT_FALSE(client->isConnected());
+
+  // the client manager removes it and counts the disconnect
+  Manager::removeDisconnected();
+  TEST_ASSERT_EQUAL_UINT32(0, Manager::clients());
+  TEST_ASSERT_EQUAL_UINT32(1, Manager::overflowDisconnects());
+}
+
+void test_failed_socket_disconnects() {
+  WiFiClient socket(SOCKET);
+  RegularClient client(&socket, nullptr);
+  ClientByteRing ring;
+  ClientLatency latency;
+  client.resetCursor(ring);
+
+  const uint8_t bytes[] = {0x10, 0x08};
+  TEST_ASSERT_TRUE(client.writeBytes(bytes, sizeof(bytes)));
+  limit = -1;
+  client.drain(ring, latency);
+  TEST_ASSERT_FALSE(client.isConnected());
+  TEST_ASSERT_FALSE(client.overflowed());
+  TEST_ASSERT_FALSE(client.writeBytes(bytes, sizeof(bytes)));
+}
+
+void test_telegram_client_drops_whole_frames() {
+  WiFiClient socket(SOCKET);
+  TelegramClient client(&socket, nullptr);
+  TelegramFrame frame;
+  frame.len = TELEGRAM_FRAME_MAX;
+  memset(frame.data, 0x11, sizeof(frame.data));
+
+  size_t frames = 0;
+  while (client.writeFrame(frame)) frames++;
+  TEST_ASSERT_EQUAL_UINT32(CLIENT_BACKLOG_SIZE / TELEGRAM_FRAME_MAX, frames);
+  TEST_ASSERT_EQUAL_UINT32(1, client.dropped());
+  TEST_ASSERT_EQUAL_UINT32(frames * TELEGRAM_FRAME_MAX, client.backlog());
+  TEST_ASSERT_TRUE(client.isConnected());
+  TEST_ASSERT_FALSE(client.overflowed());
+}
+
+void test_transmit_waits_for_echo() {
+  Manager::armTransmit();
+  TEST_ASSERT_TRUE(Manager::queueByte(0x01));
+  TEST_ASSERT_TRUE(Manager::queueByte(0x02));
+  TEST_ASSERT_TRUE(Manager::queueByte(0x03));
+
+  // the task writes the first byte, the others wait for its echo
+  Manager::continueTransmit();
+  TEST_ASSERT_EQUAL_UINT32(1, echoBus.writtenLen);
+  TEST_ASSERT_TRUE(Manager::waitsForEcho());
+  Manager::continueTransmit();
+  TEST_ASSERT_EQUAL_UINT32(1, echoBus.writtenLen);
+
+  // the listener writes the next byte with each echo
+  Manager::onBusByte(0x01);
+  TEST_ASSERT_EQUAL_UINT32(2, echoBus.writtenLen);
+  Manager::onBusByte(0x02);
+  TEST_ASSERT_EQUAL_UINT32(3, echoBus.writtenLen);
+  Manager::onBusByte(0x03);
+  TEST_ASSERT_EQUAL_UINT32(3, echoBus.writtenLen);
+  TEST_ASSERT_TRUE(Manager::transmitIdle());
+
+  // with nothing in flight the task writes again
+  TEST_ASSERT_TRUE(Manager::queueByte(0x04));
+  Manager::continueTransmit();
+  TEST_ASSERT_EQUAL_UINT32(4, echoBus.writtenLen);
+
+  const uint8_t expected[] = {0x01, 0x02, 0x03, 0x04};
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, echoBus.written, sizeof(expected));
+
+  // the SYN after the echo ends the transaction, later bytes stay unsent
+  Manager::onBusByte(0x04);
+  Manager::onBusByte(SYN);
+  TEST_ASSERT_TRUE(Manager::queueByte(0x05));
+  Manager::continueTransmit();
+  TEST_ASSERT_EQUAL_UINT32(4, echoBus.writtenLen);
+  Manager::endTransmit();
+  TEST_ASSERT_TRUE(Manager::transmitIdle());
+}
+
+void test_transmit_race_keeps_order() {
+  const size_t count = sizeof(echoBus.written);
+  Manager::armTransmit();
+
+  // the echo of a byte arrives once its write is done
+  std::atomic<bool> done{false};
+  std::thread listener([&]() {
+    uint8_t echo;
+    while (!done) {
+      if (Manager::waitsForEcho() && echoBus.echoes.pop(echo))
+        Manager::onBusByte(echo);
+      else
+        std::this_thread::yield();
+    }
+  });
+
+  // the task queues the bytes as fast as the queue takes them, SYN is left
+  // out as it would end the transaction
+  for (size_t i = 0; i < count; i++) {
+    while (!Manager::queueByte(i % SYN)) std::this_thread::yield();
+    Manager::continueTransmit();
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (echoBus.writtenLen < count &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::yield();
+
+  Manager::endTransmit();
+  done = true;
+  listener.join();
+
+  TEST_ASSERT_EQUAL_UINT32(count, echoBus.writtenLen);
+  for (size_t i = 0; i < count; i++)
+    TEST_ASSERT_EQUAL_HEX8(i % SYN, echoBus.written[i]);
+  TEST_ASSERT_TRUE(Manager::transmitIdle());
+}
+
+// The clients keep their data, so they stay pending after each selection
+void selectClients(const int expected[], size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_INT(expected[i], Manager::select());
+    fakeMicros += 100;
+  }
+}
+
+void test_round_robin_policy() {
+  const int32_t weights[CLIENTS] = {2, 1, 1, 1};
+  addPendingClients(weights);
+  clientManager.setPolicy(ClientPolicy::RoundRobin);
+
+  const int expected[] = {0, 1, 2, 0, 1, 2};
+  selectClients(expected, sizeof(expected) / sizeof(expected[0]));
+  TEST_ASSERT_FALSE(Manager::client(3)->access.waiting);
+}
+
+void test_weighted_policy() {
+  const int32_t weights[CLIENTS] = {2, 1, 1, 1};
+  addPendingClients(weights);
+  clientManager.setPolicy(ClientPolicy::Weighted);
+
+  // the first client gets two of every four turns
+  const int expected[] = {0, 1, 2, 0, 0, 1, 2, 0};
+  selectClients(expected, sizeof(expected) / sizeof(expected[0]));
+  TEST_ASSERT_EQUAL_UINT32(4, Manager::client(0)->access.granted);
+  TEST_ASSERT_EQUAL_UINT32(2, Manager::client(1)->access.granted);
+}
+
+void test_fifo_policy() {
+  const int32_t weights[CLIENTS] = {1, 1, 1, 1};
+  addPendingClients(weights);
+  clientManager.setPolicy(ClientPolicy::Fifo);
+
+  // waiting since 300, 100 and 200, a served client waits again from the
+  // next selection on
+  const uint32_t since[] = {300, 100, 200};
+  for (size_t i = 0; i < 3; i++) {
+    Manager::client(i)->access.waiting = true;
+    Manager::client(i)->access.since = since[i];
+  }
+  fakeMicros = 1000;
+  const int expected[] = {1, 2, 0, 1, 2, 0};
+  selectClients(expected, sizeof(expected) / sizeof(expected[0]));
+  TEST_ASSERT_EQUAL_UINT32(900, Manager::client(1)->access.waitMax);
+}
+
+FilterSpec sourceFilter(uint8_t qq) {
+  FilterSpec spec;
+  spec.anyQQ = false;
+  spec.qq[qq >> 5] |= 1UL << (qq & 31);
+  return spec;
+}
+
+void test_filters_count_saved_bytes() {
+  WiFiClient socket10(SOCKET), socket31(SOCKET);
+  AbstractClient* client10 = new ReadOnlyClient(&socket10, nullptr);
+  AbstractClient* client31 = new ReadOnlyClient(&socket31, nullptr);
+  Manager::addClient(client10);
+  Manager::addClient(client31);
+  Manager::setFilter(client10, sourceFilter(0x10));
+  Manager::setFilter(client31, sourceFilter(0x31));
+
+  // a telegram of 0x10 and its SYN
+  const uint8_t telegram[] = {0x10, 0xfe, 0xb5, 0x16, 0x01, 0x00, 0x9d, SYN};
+  Manager::filterBytes(telegram, sizeof(telegram));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram), client10->filter.forwarded);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram), client10->backlog());
+  TEST_ASSERT_EQUAL_UINT32(0, client10->filter.saved);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram), client31->filter.saved);
+
+  // a telegram too long for the filters is neither forwarded nor saved
+  uint8_t longTelegram[FILTER_TELEGRAM_MAX + 8];
+  memset(longTelegram, 0x10, sizeof(longTelegram));
+  longTelegram[sizeof(longTelegram) - 1] = SYN;
+  Manager::filterBytes(longTelegram, sizeof(longTelegram));
+  TEST_ASSERT_EQUAL_UINT32(1, Manager::filterOverflows());
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram), client10->filter.forwarded);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram), client31->filter.saved);
+
+  // the next telegram is filtered again
+  Manager::filterBytes(telegram, sizeof(telegram));
+  TEST_ASSERT_EQUAL_UINT32(2 * sizeof(telegram), client10->filter.forwarded);
+  TEST_ASSERT_EQUAL_UINT32(2 * sizeof(telegram), client31->filter.saved);
+}
+
+void test_disconnect_recompiles_filters() {
+  WiFiClient socket10(SOCKET), socket31(SOCKET);
+  AbstractClient* client10 = new ReadOnlyClient(&socket10, nullptr);
+  AbstractClient* client31 = new ReadOnlyClient(&socket31, nullptr);
+  Manager::addClient(client10);
+  Manager::addClient(client31);
+  Manager::setFilter(client10, sourceFilter(0x10));
+  Manager::setFilter(client31, sourceFilter(0x31));
+  TEST_ASSERT_EQUAL_UINT8(1, client31->filter.slot);
+
+  // the slot of the client that left is given to the remaining one
+  client10->stop();
+  Manager::removeDisconnected();
+  Manager::updateFilters();
+  TEST_ASSERT_EQUAL_UINT32(1, Manager::clients());
+  TEST_ASSERT_EQUAL_UINT8(0, client31->filter.slot);
+
+  const uint8_t telegram10[] = {0x10, 0xfe, 0xb5, 0x16, 0x01, 0x00, 0x9d, SYN};
+  Manager::filterBytes(telegram10, sizeof(telegram10));
+  TEST_ASSERT_EQUAL_UINT32(0, client31->filter.forwarded);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram10), client31->filter.saved);
+
+  const uint8_t telegram31[] = {0x31, 0xfe, 0xb5, 0x16, 0x01, 0x00, 0x3c, SYN};
+  Manager::filterBytes(telegram31, sizeof(telegram31));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(telegram31), client31->filter.forwarded);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_backlog_partial_writes);
+  RUN_TEST(test_backlog_overflow_disconnects);
+  RUN_TEST(test_failed_socket_disconnects);
+  RUN_TEST(test_telegram_client_drops_whole_frames);
+  RUN_TEST(test_transmit_waits_for_echo);
+  RUN_TEST(test_transmit_race_keeps_order);
+  RUN_TEST(test_round_robin_policy);
+  RUN_TEST(test_weighted_policy);
+  RUN_TEST(test_fifo_policy);
+  RUN_TEST(test_filters_count_saved_bytes);
+  RUN_TEST(test_disconnect_recompiles_filters);
+  return UNITY_END();
+}
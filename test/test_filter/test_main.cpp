@@ -0,0 +1,52 @@
+#include <unity.h>
+
+#include "filter.hpp"
+
+void setUp() {}
+void tearDown() {}
+
+void test_parse_valid() {
+  FilterSpec spec;
+  TEST_ASSERT_TRUE(
+      spec.parse("{\"QQ\":[\"10\",\"ff\"],\"ZZ\":[\"08\"],\"PBSB\":[\"b509\","
+                 "\"07\"]}"));
+  TEST_ASSERT_FALSE(spec.anyQQ);
+  TEST_ASSERT_FALSE(spec.anyZZ);
+  TEST_ASSERT_EQUAL_UINT8(2, spec.prefixes);
+  TEST_ASSERT_EQUAL_HEX16(0xb509, spec.pbsb[0]);
+  TEST_ASSERT_EQUAL_HEX16(0x0700, spec.pbsb[1]);
+  TEST_ASSERT_EQUAL_HEX16(0xff00, spec.mask[1]);
+}
+
+void test_parse_rejects_sign_and_prefix() {
+  const char* lines[] = {
+      "{\"QQ\":[\"-1\"]}",   "{\"QQ\":[\"+f\"]}",   "{\"QQ\":[\"0x\"]}",
+      "{\"ZZ\":[\"-1\"]}",   "{\"ZZ\":[\"+f\"]}",   "{\"ZZ\":[\"0x\"]}",
+      "{\"PBSB\":[\"-1\"]}", "{\"PBSB\":[\"+f\"]}", "{\"PBSB\":[\"0x12\"]}",
+      "{\"QQ\":[\"-001\"]}", "{\"QQ\":[\"1g\"]}",   "{\"QQ\":[\"100\"]}",
+  };
+  for (const char* line : lines) {
+    FilterSpec spec;
+    TEST_ASSERT_FALSE_MESSAGE(spec.parse(line), line);
+  }
+}
+
+void test_match() {
+  FilterSpec spec;
+  TEST_ASSERT_TRUE(spec.parse("{\"QQ\":[\"10\"],\"PBSB\":[\"b5\"]}"));
+  FilterTable* table = new FilterTable();
+  table->clear();
+  table->add(3, spec);
+  TEST_ASSERT_EQUAL_HEX32(1UL << 3, table->match(0x10, 0x08, 0xb5, 0x11));
+  TEST_ASSERT_EQUAL_HEX32(0, table->match(0x31, 0x08, 0xb5, 0x11));
+  TEST_ASSERT_EQUAL_HEX32(0, table->match(0x10, 0x08, 0x07, 0x04));
+  delete table;
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_valid);
+  RUN_TEST(test_parse_rejects_sign_and_prefix);
+  RUN_TEST(test_match);
+  return UNITY_END();
+}
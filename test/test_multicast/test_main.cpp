@@ -0,0 +1,109 @@
+#include <unity.h>
+
+#include <lwip/sockets.h>
+#include <unistd.h>
+
+#include "client.hpp"
+#include "multicast.hpp"
+
+// Telegrams sent to the multicast group and received by a listener that
+// joined it on this host
+
+int listener = -1;
+uint16_t listenerPort = 0;
+
+TelegramFrame makeFrame(uint32_t sequence, uint8_t value) {
+  TelegramFrame frame;
+  frame.sequence = sequence;
+  // time, message type, telegram type, status, master and slave
+  const uint8_t body[] = {0x78, 0x56, 0x34, 0x12, 0x01, 0x02, TELEGRAM_OK,
+                          0x06, 0x10, 0x08, 0xb5, 0x11, 0x01, value,
+                          0x02, value, 0x00};
+  frame.len = 2 + sizeof(body);
+  frame.data[0] = sizeof(body);
+  frame.data[1] = 0;
+  memcpy(frame.data + 2, body, sizeof(body));
+  return frame;
+}
+
+// Returns the length of the datagram, 0 if none arrived
+size_t receive(uint8_t* buffer, size_t size) {
+  timeval timeout = {0, 200000};
+  setsockopt(listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  ssize_t len = recv(listener, buffer, size, 0);
+  return len > 0 ? len : 0;
+}
+
+void setUp() {
+  listener = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+  socklen_t len = sizeof(address);
+  getsockname(listener, reinterpret_cast<sockaddr*>(&address), &len);
+  listenerPort = ntohs(address.sin_port);
+
+  ip_mreq membership = {};
+  inet_aton(MULTICAST_GROUP, &membership.imr_multiaddr);
+  membership.imr_interface.s_addr = htonl(INADDR_ANY);
+  setsockopt(listener, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+             sizeof(membership));
+}
+
+void tearDown() {
+  multicast.setEnabled(false);
+  close(listener);
+}
+
+void test_set_group() {
+  TEST_ASSERT_TRUE(multicast.setGroup(MULTICAST_GROUP, MULTICAST_PORT));
+  TEST_ASSERT_TRUE(multicast.setGroup("192.168.1.255", MULTICAST_PORT));
+  TEST_ASSERT_FALSE(multicast.setGroup("ebus.local", MULTICAST_PORT));
+}
+
+void test_telegrams_are_received_once() {
+  TEST_ASSERT_TRUE(multicast.setGroup(MULTICAST_GROUP, listenerPort));
+  multicast.setEnabled(true);
+  uint32_t sent = multicast.sent();
+
+  for (uint32_t sequence = 0xfffffffe; sequence != 2; sequence++)
+    multicast.send(makeFrame(sequence, sequence & 0xff));
+  TEST_ASSERT_EQUAL_UINT32(sent + 4, multicast.sent());
+
+  uint8_t datagram[4 + TELEGRAM_FRAME_MAX];
+  for (uint32_t sequence = 0xfffffffe; sequence != 2; sequence++) {
+    TelegramFrame frame = makeFrame(sequence, sequence & 0xff);
+    TEST_ASSERT_EQUAL(4 + frame.len - 2, receive(datagram, sizeof(datagram)));
+    // the sequence number little endian, then the frame without its length
+    TEST_ASSERT_EQUAL_HEX32(sequence, datagram[0] | datagram[1] << 8 |
+                                          datagram[2] << 16 |
+                                          static_cast<uint32_t>(datagram[3])
+                                              << 24);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(frame.data + 2, datagram + 4, frame.len - 2);
+  }
+  TEST_ASSERT_EQUAL(0, receive(datagram, sizeof(datagram)));
+}
+
+void test_disabled_sends_nothing() {
+  TEST_ASSERT_TRUE(multicast.setGroup(MULTICAST_GROUP, listenerPort));
+  multicast.setEnabled(true);
+  multicast.send(makeFrame(1, 1));
+  multicast.setEnabled(false);
+  uint32_t sent = multicast.sent();
+  multicast.send(makeFrame(2, 2));
+  TEST_ASSERT_EQUAL_UINT32(sent, multicast.sent());
+
+  uint8_t datagram[4 + TELEGRAM_FRAME_MAX];
+  TEST_ASSERT_TRUE(receive(datagram, sizeof(datagram)) > 0);
+  TEST_ASSERT_EQUAL_HEX8(1, datagram[0]);
+  TEST_ASSERT_EQUAL(0, receive(datagram, sizeof(datagram)));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_set_group);
+  RUN_TEST(test_telegrams_are_received_once);
+  RUN_TEST(test_disabled_sends_nothing);
+  return UNITY_END();
+}
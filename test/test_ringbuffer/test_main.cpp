@@ -0,0 +1,118 @@
+#include <unity.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "bus.hpp"
+#include "ringbuffer.hpp"
+
+// The receive ring of BusType between a producer and a consumer thread. The
+// producer replays bus bytes at the pace of the bus, the consumer wakes up
+// once per millisecond like a busy data_process.
+
+typedef RingBuffer<BusType::data, QUEUE_SIZE> Queue;
+typedef std::chrono::steady_clock Clock;
+
+// 10 bits per symbol at 2400 baud
+const double SYMBOL_MICROS = 1e7 / 2400;
+
+struct Replay {
+  size_t received = 0;
+  size_t overflows = 0;
+  size_t outOfOrder = 0;
+  size_t maxQueued = 0;
+  double seconds = 0;
+};
+
+// Pushes count records, speedup times faster than the bus
+Replay replay(size_t count, double speedup) {
+  Queue* queue = new Queue();
+  Replay result;
+  std::atomic<bool> done{false};
+
+  std::thread consumer([&]() {
+    BusType::data d;
+    uint8_t expected = 0;
+    for (;;) {
+      bool finished = done.load();
+      while (queue->pop(d)) {
+        if (d._d != expected) result.outOfOrder++;
+        expected = d._d + 1;
+        result.received++;
+      }
+      if (finished) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  const auto period = std::chrono::duration<double, std::micro>(
+      SYMBOL_MICROS / speedup);
+  const auto start = Clock::now();
+  for (size_t i = 0; i < count; i++) {
+    std::this_thread::sleep_until(
+        start + std::chrono::duration_cast<Clock::duration>(period * i));
+    BusType::data d = {0, 0, static_cast<uint8_t>(i), NO_CLIENT};
+    if (!queue->push(d)) result.overflows++;
+    size_t queued = queue->size();
+    if (queued > result.maxQueued) result.maxQueued = queued;
+  }
+  done = true;
+  consumer.join();
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  delete queue;
+
+  char line[96];
+  snprintf(line, sizeof(line), "%gx: %zu records/s, at most %zu queued",
+           speedup, static_cast<size_t>(result.received / result.seconds),
+           result.maxQueued);
+  TEST_MESSAGE(line);
+  return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_record_is_compact() { TEST_ASSERT_EQUAL(4, sizeof(BusType::data)); }
+
+void test_full_and_wrap_around() {
+  RingBuffer<uint8_t, 4> ring;
+  uint8_t value;
+  for (uint8_t round = 0; round < 3; round++) {
+    for (uint8_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(ring.push(round + i));
+    TEST_ASSERT_FALSE(ring.push(0xff));
+    TEST_ASSERT_EQUAL(4, ring.size());
+    TEST_ASSERT_TRUE(ring.peek(value));
+    TEST_ASSERT_EQUAL_UINT8(round, value);
+    for (uint8_t i = 0; i < 4; i++) {
+      TEST_ASSERT_TRUE(ring.pop(value));
+      TEST_ASSERT_EQUAL_UINT8(round + i, value);
+    }
+    TEST_ASSERT_FALSE(ring.pop(value));
+    TEST_ASSERT_TRUE(ring.empty());
+  }
+}
+
+void test_bus_speed() {
+  Replay result = replay(240, 1);  // one second of bus
+  TEST_ASSERT_EQUAL(240, result.received);
+  TEST_ASSERT_EQUAL(0, result.overflows);
+  TEST_ASSERT_EQUAL(0, result.outOfOrder);
+}
+
+void test_hundred_times_bus_speed() {
+  Replay result = replay(24000, 100);
+  TEST_ASSERT_EQUAL(24000, result.received);
+  TEST_ASSERT_EQUAL(0, result.overflows);
+  TEST_ASSERT_EQUAL(0, result.outOfOrder);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_record_is_compact);
+  RUN_TEST(test_full_and_wrap_around);
+  RUN_TEST(test_bus_speed);
+  RUN_TEST(test_hundred_times_bus_speed);
+  return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+
+#include <cstring>
+
+#include "busstate.hpp"
+#include "telegram.hpp"
+
+// Telegrams fed symbol by symbol to the decoder, each starting with the SYN
+// that freed the bus before it
+
+uint32_t fakeMicros = 0;
+
+void feed(TelegramDecoder& decoder, const uint8_t* symbols, size_t len) {
+  for (size_t i = 0; i < len; i++) decoder.data(symbols[i]);
+}
+
+// Master slave telegram 10 08 b5 11 01 01 with the response 55
+const uint8_t MASTER_SLAVE[] = {SYN,  0x10, 0x08, 0xb5, 0x11, 0x01, 0x01,
+                                0x89, ACK,  0x01, 0x55, 0xce, ACK};
+
+void setUp() {}
+void tearDown() {}
+
+void test_crc8() {
+  uint8_t crc = 0;
+  for (size_t i = 1; i < 7; i++)
+    crc = TelegramDecoder::crc8(crc, MASTER_SLAVE[i]);
+  TEST_ASSERT_EQUAL_HEX8(0x89, crc);
+}
+
+void test_master_slave_telegram() {
+  TelegramDecoder decoder;
+  // symbols still to come after each symbol, -1 if not followed
+  const int remaining[] = {-1, -1, 8, 7, 6, 6, 5, 4, 3, 3, 2, 1, 0};
+  for (size_t i = 0; i < sizeof(MASTER_SLAVE); i++) {
+    decoder.data(MASTER_SLAVE[i]);
+    TEST_ASSERT_EQUAL_INT(remaining[i], decoder.remaining());
+  }
+  TEST_ASSERT_TRUE(decoder.done());
+  TEST_ASSERT_EQUAL_INT(1, decoder._telegrams);
+  TEST_ASSERT_EQUAL_INT(1, decoder._masterSlave);
+  TEST_ASSERT_EQUAL_INT(0, decoder._crcErrors);
+  TEST_ASSERT_EQUAL_INT(0, decoder._slaveCrcErrors);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder._sizes[1]);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder._sources[0x10]);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder._targets[0x08]);
+}
+
+void test_crc_errors() {
+  TelegramDecoder decoder;
+  uint8_t telegram[sizeof(MASTER_SLAVE)];
+  memcpy(telegram, MASTER_SLAVE, sizeof(telegram));
+  telegram[7] ^= 0x01;
+  feed(decoder, telegram, sizeof(telegram));
+  TEST_ASSERT_EQUAL_INT(1, decoder._crcErrors);
+  TEST_ASSERT_EQUAL_INT(0, decoder._slaveCrcErrors);
+
+  memcpy(telegram, MASTER_SLAVE, sizeof(telegram));
+  telegram[11] ^= 0x01;
+  feed(decoder, telegram, sizeof(telegram));
+  TEST_ASSERT_EQUAL_INT(1, decoder._crcErrors);
+  TEST_ASSERT_EQUAL_INT(1, decoder._slaveCrcErrors);
+  // the telegrams are still complete
+  TEST_ASSERT_EQUAL_INT(2, decoder._telegrams);
+}
+
+void test_escaped_data_and_crc() {
+  TelegramDecoder decoder;
+  // the data bytes SYN and ESC, the CRC covers the escape sequences
+  const uint8_t escapedData[] = {SYN,  0x10, BROADCAST, 0x07, 0x00, 0x02,
+                                 ESC,  0x01, ESC,       0x00, 0xfb};
+  feed(decoder, escapedData, sizeof(escapedData) - 1);
+  TEST_ASSERT_EQUAL_INT(1, decoder.remaining());
+  decoder.data(escapedData[sizeof(escapedData) - 1]);
+  TEST_ASSERT_TRUE(decoder.done());
+
+  // a CRC of SYN is escaped as well
+  const uint8_t escapedCrc[] = {SYN, 0x10, BROADCAST, 0x07, 0x00,
+                                0x01, 0x35, ESC,      0x01};
+  feed(decoder, escapedCrc, sizeof(escapedCrc));
+  TEST_ASSERT_TRUE(decoder.done());
+  TEST_ASSERT_EQUAL_INT(2, decoder._broadcast);
+  TEST_ASSERT_EQUAL_INT(0, decoder._crcErrors);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder._sizes[2]);
+  TEST_ASSERT_EQUAL_UINT32(1, decoder._sizes[1]);
+}
+
+void test_invalid_escape_aborts() {
+  TelegramDecoder decoder;
+  const uint8_t invalid[] = {SYN,  0x10, BROADCAST, 0x07,
+                             0x00, 0x01, ESC,       0x05};
+  feed(decoder, invalid, sizeof(invalid));
+  TEST_ASSERT_EQUAL_INT(1, decoder._aborted);
+  TEST_ASSERT_EQUAL_INT(-1, decoder.remaining());
+  TEST_ASSERT_FALSE(decoder.done());
+
+  // followed again from the next SYN
+  feed(decoder, MASTER_SLAVE, sizeof(MASTER_SLAVE));
+  TEST_ASSERT_EQUAL_INT(1, decoder._telegrams);
+}
+
+void test_repetition_after_nack() {
+  TelegramDecoder decoder;
+  const uint8_t nack[] = {SYN,  0x10, 0x08, 0xb5, 0x11,
+                          0x01, 0x01, 0x88, NACK};
+  feed(decoder, nack, sizeof(nack));
+  TEST_ASSERT_EQUAL_INT(1, decoder._crcErrors);
+  TEST_ASSERT_EQUAL_INT(1, decoder._naks);
+  TEST_ASSERT_EQUAL_INT(-1, decoder.remaining());
+
+  // the master repeats its part without a SYN
+  feed(decoder, MASTER_SLAVE + 1, sizeof(MASTER_SLAVE) - 1);
+  TEST_ASSERT_TRUE(decoder.done());
+  TEST_ASSERT_EQUAL_INT(1, decoder._telegrams);
+  TEST_ASSERT_EQUAL_INT(0, decoder._aborted);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc8);
+  RUN_TEST(test_master_slave_telegram);
+  RUN_TEST(test_crc_errors);
+  RUN_TEST(test_escaped_data_and_crc);
+  RUN_TEST(test_invalid_escape_aborts);
+  RUN_TEST(test_repetition_after_nack);
+  return UNITY_END();
+}